@@ -1,7 +1,6 @@
 #include "camera.h"
 #include "utils/sceneparser.h"
 #include <iostream>
-#include <stdexcept>
 
 Camera::Camera(const RenderData &metaData, int width, int height) {
   glm::vec3 look = metaData.cameraData.look;
@@ -17,6 +16,8 @@ Camera::Camera(const RenderData &metaData, int width, int height) {
                                   -pos.y, -pos.z, 1);
   heightAngle = metaData.cameraData.heightAngle;
   aspectRatio = (float)width / (float)height;
+  aperture = metaData.cameraData.aperture;
+  focalLength = metaData.cameraData.focalLength;
 }
 
 glm::vec3 Camera::getPos() const {
@@ -36,10 +37,6 @@ float Camera::getHeightAngle() const { return heightAngle; }
 
 float Camera::getWidthAngle() const { return heightAngle * aspectRatio; }
 
-float Camera::getFocalLength() const {
-  throw std::runtime_error("not implemented");
-}
+float Camera::getFocalLength() const { return focalLength; }
 
-float Camera::getAperture() const {
-  throw std::runtime_error("not implemented");
-}
+float Camera::getAperture() const { return aperture; }
@@ -16,6 +16,8 @@ private:
   glm::mat4 viewMatrix;
   float aspectRatio;
   float heightAngle;
+  float aperture;
+  float focalLength;
 
 public:
   // Returns the view matrix for the current camera settings.
@@ -38,13 +40,9 @@ public:
 
   float getWidthAngle() const;
 
-  // Returns the focal length of this camera.
-  // This is for the depth of field extra-credit feature only;
-  // You can ignore if you are not attempting to implement depth of field.
+  // Returns the distance from the camera to the plane in focus.
   float getFocalLength() const;
 
-  // Returns the focal length of this camera.
-  // This is for the depth of field extra-credit feature only;
-  // You can ignore if you are not attempting to implement depth of field.
+  // Returns the diameter of the camera's lens; zero for a pinhole camera.
   float getAperture() const;
 };
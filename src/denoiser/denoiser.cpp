@@ -0,0 +1,120 @@
+#include "denoiser.h"
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr int TILE_SIZE = 64;
+
+// The 1D B-spline kernel the 5x5 taps are built from
+constexpr float KERNEL[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4,
+                             1.0f / 16};
+
+} // namespace
+
+Denoiser::Denoiser(Settings settings) : m_settings(settings) {}
+
+void Denoiser::denoise(FrameBuffer &frame) const {
+  if (!frame.hasGuides()) {
+    return;
+  }
+  int width = frame.width();
+  int height = frame.height();
+  std::vector<glm::vec4> source(width * height);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      source[y * width + x] = frame.color(x, y);
+    }
+  }
+  std::vector<glm::vec4> destination(width * height);
+
+  std::vector<glm::ivec2> tiles;
+  for (int y = 0; y < height; y += TILE_SIZE) {
+    for (int x = 0; x < width; x += TILE_SIZE) {
+      tiles.push_back(glm::ivec2(x, y));
+    }
+  }
+  float colorSigma = m_settings.colorSigma;
+  for (int iteration = 0; iteration < m_settings.iterations; iteration++) {
+    int step = 1 << iteration;
+    // Tiles only write their own pixels and read the previous iteration, so
+    // they can run in any order
+    auto filter = [&](const glm::ivec2 &tile) {
+      filterTile(frame, source, destination, tile.x, tile.y, step,
+                 colorSigma);
+    };
+    if (m_settings.parallel) {
+      QtConcurrent::blockingMap(tiles, filter);
+    } else {
+      std::for_each(tiles.begin(), tiles.end(), filter);
+    }
+    std::swap(source, destination);
+    colorSigma /= 2;
+  }
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      frame.color(x, y) = source[y * width + x];
+    }
+  }
+}
+
+int Denoiser::reach() const {
+  // Each iteration reaches two taps out, at its step
+  return 2 * ((1 << m_settings.iterations) - 1);
+}
+
+void Denoiser::filterTile(const FrameBuffer &frame,
+                          const std::vector<glm::vec4> &source,
+                          std::vector<glm::vec4> &destination, int tileX,
+                          int tileY, int step, float colorSigma) const {
+  int width = frame.width();
+  int height = frame.height();
+  float colorFactor = 1 / (colorSigma * colorSigma);
+  float normalFactor = 1 / (m_settings.normalSigma * m_settings.normalSigma);
+  float albedoFactor = 1 / (m_settings.albedoSigma * m_settings.albedoSigma);
+  for (int y = tileY; y < std::min(tileY + TILE_SIZE, height); y++) {
+    for (int x = tileX; x < std::min(tileX + TILE_SIZE, width); x++) {
+      const PixelGuides &centre = frame.guides(x, y);
+      glm::vec4 centreColor = source[y * width + x];
+      glm::vec4 sum(0, 0, 0, 0);
+      float weightSum = 0;
+      for (int dy = -2; dy <= 2; dy++) {
+        int qy = y + dy * step;
+        if (qy < 0 || qy >= height) {
+          continue;
+        }
+        for (int dx = -2; dx <= 2; dx++) {
+          int qx = x + dx * step;
+          if (qx < 0 || qx >= width) {
+            continue;
+          }
+          const PixelGuides &tap = frame.guides(qx, qy);
+          if (tap.primitive != centre.primitive) {
+            continue;
+          }
+          glm::vec4 tapColor = source[qy * width + qx];
+          glm::vec3 colorDifference = glm::vec3(tapColor - centreColor);
+          float exponent =
+              glm::dot(colorDifference, colorDifference) * colorFactor;
+          if (centre.primitive != -1) {
+            glm::vec3 normalDifference = tap.normal - centre.normal;
+            glm::vec3 albedoDifference = tap.albedo - centre.albedo;
+            float distance = step * std::sqrt(float(dx * dx + dy * dy));
+            exponent +=
+                glm::dot(normalDifference, normalDifference) * normalFactor +
+                glm::dot(albedoDifference, albedoDifference) * albedoFactor +
+                std::abs(tap.depth - centre.depth) /
+                    (m_settings.depthSigma * centre.depth * distance + 1e-6f);
+          }
+          float weight = KERNEL[dx + 2] * KERNEL[dy + 2] * std::exp(-exponent);
+          sum += weight * tapColor;
+          weightSum += weight;
+        }
+      }
+      // The centre tap always has a positive weight
+      destination[y * width + x] = sum / weightSum;
+    }
+  }
+}
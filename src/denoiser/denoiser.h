@@ -0,0 +1,46 @@
+#pragma once
+
+#include "raytracer/framebuffer.h"
+
+// An edge-avoiding a-trous wavelet filter (Dammertz et al. 2010).
+
+// Each iteration blurs with a 5x5 B-spline kernel whose taps are spread
+// twice as far apart as in the previous one, so a few iterations cover a wide
+// area cheaply. Every tap is weighted down where it differs from the centre
+// pixel in color, normal, albedo or depth, and skipped where it shows another
+// primitive, so noise is smoothed but edges, creases and texture detail are
+// kept. Iterations run over tiles on the thread pool.
+
+class Denoiser {
+public:
+  struct Settings {
+    int iterations = 5;
+    // Color differences tolerated by the first iteration; each later
+    // iteration, spanning a wider area, tolerates half as much
+    float colorSigma = 0.5f;
+    float normalSigma = 0.3f;
+    float albedoSigma = 0.1f;
+    // Depth difference tolerated per pixel of distance, relative to depth
+    float depthSigma = 0.1f;
+    bool parallel = true;
+  };
+
+  Denoiser(Settings settings);
+
+  // Filters frame's colors in place. Frames without guides are left as is.
+  void denoise(FrameBuffer &frame) const;
+
+  // Returns how far, in pixels, a filtered color can draw on the frame.
+  // Filtering part of a frame with this much of its surroundings gives the
+  // same colors as filtering all of it.
+  int reach() const;
+
+private:
+  // Runs one iteration over the pixels of a tile, reading from source
+  void filterTile(const FrameBuffer &frame,
+                  const std::vector<glm::vec4> &source,
+                  std::vector<glm::vec4> &destination, int tileX, int tileY,
+                  int step, float colorSigma) const;
+
+  Settings m_settings;
+};
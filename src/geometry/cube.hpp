@@ -1,28 +1,24 @@
 #pragma once
 
 #include "primitive.h"
+#include "texture/texturemap.h"
 #include <iostream>
+#include <memory>
 
 class Cube : public Primitive {
 private:
   SceneMaterial material;
   glm::mat4 ctm;
-  QImage texture;
-  float repeatU;
-  float repeatV;
+  TextureMap textureMap;
 
 public:
-  Cube(SceneMaterial m, glm::mat4 c) {
+  Cube(SceneMaterial m, glm::mat4 c, std::shared_ptr<const Texture> t) {
     this->material = m;
     this->ctm = c;
+    this->textureMap.texture = t;
     if (m.textureMap.filename != "") {
-      repeatU = m.textureMap.repeatU;
-      repeatV = m.textureMap.repeatV;
-      texture = QImage(QString::fromStdString(m.textureMap.filename));
-      if (texture.isNull()) {
-        std::cout << "Failed to load texture: " << m.textureMap.filename
-                  << std::endl;
-      }
+      textureMap.repeatU = m.textureMap.repeatU;
+      textureMap.repeatV = m.textureMap.repeatV;
     }
   };
 
@@ -53,6 +49,7 @@ public:
   }
 
   glm::mat4 getCTM() { return ctm; }
+  void setCTM(glm::mat4 c) { ctm = c; }
   SceneMaterial getMaterial() { return material; }
 
   glm::vec3 getNormal(glm::vec3 point) {
@@ -76,10 +73,7 @@ public:
     return normal;
   }
 
-  RGBA getTextureColor(glm::vec3 point) {
-    if (texture.isNull()) {
-      return RGBA{0, 0, 0, 0};
-    }
+  glm::vec2 getUV(glm::vec3 point) {
     float x = point.x;
     float y = point.y;
     float z = point.z;
@@ -104,17 +98,17 @@ public:
       u = (-x + 0.5) / 1;
       v = (y + 0.5) / 1;
     }
-    if (u == 1) {
-      u -= 1.0 / texture.width();
+    return glm::vec2(u, v);
+  }
+
+  glm::vec4 getTextureColor(glm::vec3 point, glm::vec3 dpdx, glm::vec3 dpdy) {
+    if (!textureMap.texture) {
+      return glm::vec4(0, 0, 0, 0);
     }
-    if (v == 0) {
-      v -= 1.0 / texture.height();
+    glm::vec2 uv = getUV(point);
+    if (dpdx == glm::vec3(0) && dpdy == glm::vec3(0)) {
+      return textureMap.sample(uv);
     }
-    QColor color = texture.pixelColor(
-        (int)floor(u * texture.width() * repeatU) % texture.width(),
-        (int)floor((1 - v) * texture.height() * repeatV) % texture.height());
-    return RGBA{static_cast<uint8_t>(color.red()),
-                static_cast<uint8_t>(color.green()),
-                static_cast<uint8_t>(color.blue()), 255};
+    return textureMap.sample(uv, getUV(point + dpdx), getUV(point + dpdy));
   }
 };
@@ -1,16 +1,21 @@
 #pragma once
 
 #include "raytracer/ray.hpp"
-#include "utils/rgba.h"
 #include "utils/scenedata.h"
-#include <QColor>
-#include <QImage>
 
 class Primitive {
 public:
   virtual float intersect(Ray &ray) = 0;
   virtual glm::vec3 getNormal(glm::vec3 point) = 0;
   virtual glm::mat4 getCTM() = 0;
+  // Moves the primitive, for shapes animated between frames.
+  virtual void setCTM(glm::mat4 ctm) = 0;
   virtual SceneMaterial getMaterial() = 0;
-  virtual RGBA getTextureColor(glm::vec3 point) = 0;
+  // Returns the surface coordinates of an object-space point on the surface.
+  virtual glm::vec2 getUV(glm::vec3 point) = 0;
+  // Returns the texture color at point. dpdx and dpdy are the object-space
+  // offsets to the surface points seen through the neighbouring pixels; when
+  // both are zero the texture is point-sampled at full resolution.
+  virtual glm::vec4 getTextureColor(glm::vec3 point, glm::vec3 dpdx,
+                                    glm::vec3 dpdy) = 0;
 };
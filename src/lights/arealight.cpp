@@ -0,0 +1,96 @@
+#include "arealight.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Below this solid angle (in steradians) the spherical rectangle's angles
+// cancel too badly in float, and sampling by area is as good anyway
+constexpr float MIN_SOLID_ANGLE = 1e-4f;
+
+} // namespace
+
+AreaLight::AreaLight(const SceneLightData &light, glm::vec3 point)
+    : m_point(point), m_solidAngleSampling(false) {
+  m_normal = glm::normalize(glm::vec3(light.dir));
+  glm::vec3 up = std::abs(m_normal.y) > 0.999f ? glm::vec3(1, 0, 0)
+                                                : glm::vec3(0, 1, 0);
+  glm::vec3 u = glm::normalize(glm::cross(up, m_normal));
+  glm::vec3 v = glm::cross(m_normal, u);
+  m_edgeX = light.width * u;
+  m_edgeY = light.height * v;
+  m_corner = glm::vec3(light.pos) - 0.5f * (m_edgeX + m_edgeY);
+  m_area = light.width * light.height;
+  m_facing = m_area > 0 && glm::dot(point - glm::vec3(light.pos), m_normal) > 0;
+  if (!m_facing) {
+    return;
+  }
+
+  float widthLength = light.width;
+  float heightLength = light.height;
+  m_x = u;
+  m_y = v;
+  m_z = glm::cross(m_x, m_y);
+  glm::vec3 d = m_corner - point;
+  m_z0 = glm::dot(d, m_z);
+  if (m_z0 > 0) {
+    m_z = -m_z;
+    m_z0 = -m_z0;
+  }
+  m_x0 = glm::dot(d, m_x);
+  m_y0 = glm::dot(d, m_y);
+  m_x1 = m_x0 + widthLength;
+  m_y1 = m_y0 + heightLength;
+
+  // Normals of the planes through the point and each edge, and the
+  // rectangle's interior angles on the sphere
+  glm::vec3 v00(m_x0, m_y0, m_z0);
+  glm::vec3 v01(m_x0, m_y1, m_z0);
+  glm::vec3 v10(m_x1, m_y0, m_z0);
+  glm::vec3 v11(m_x1, m_y1, m_z0);
+  glm::vec3 n0 = glm::normalize(glm::cross(v00, v10));
+  glm::vec3 n1 = glm::normalize(glm::cross(v10, v11));
+  glm::vec3 n2 = glm::normalize(glm::cross(v11, v01));
+  glm::vec3 n3 = glm::normalize(glm::cross(v01, v00));
+  float g0 = std::acos(std::clamp(-glm::dot(n0, n1), -1.0f, 1.0f));
+  float g1 = std::acos(std::clamp(-glm::dot(n1, n2), -1.0f, 1.0f));
+  float g2 = std::acos(std::clamp(-glm::dot(n2, n3), -1.0f, 1.0f));
+  float g3 = std::acos(std::clamp(-glm::dot(n3, n0), -1.0f, 1.0f));
+  m_b0 = n0.z;
+  m_b1 = n2.z;
+  m_k = 2 * static_cast<float>(M_PI) - g2 - g3;
+  m_solidAngle = g0 + g1 - m_k;
+  m_solidAngleSampling = m_solidAngle > MIN_SOLID_ANGLE;
+}
+
+bool AreaLight::isFacing() const { return m_facing; }
+
+glm::vec3 AreaLight::sample(glm::vec2 u, float &weight) const {
+  if (!m_solidAngleSampling) {
+    // Uniform over the area, weighted by the emitter's foreshortening
+    glm::vec3 position = m_corner + u.x * m_edgeX + u.y * m_edgeY;
+    weight = glm::dot(glm::normalize(m_point - position), m_normal);
+    return position;
+  }
+
+  // Pick the x coordinate so that the solid angle to its left is u.x of the
+  // total, then y likewise within that slice
+  float au = u.x * m_solidAngle + m_k;
+  float fu = (std::cos(au) * m_b0 - m_b1) / std::sin(au);
+  float cu = std::clamp(
+      std::copysign(1.0f, fu) / std::sqrt(fu * fu + m_b0 * m_b0), -1.0f, 1.0f);
+  float xu = -(cu * m_z0) / std::sqrt(std::max(1 - cu * cu, 1e-12f));
+  xu = std::clamp(xu, m_x0, m_x1);
+  float d = std::sqrt(xu * xu + m_z0 * m_z0);
+  float h0 = m_y0 / std::sqrt(d * d + m_y0 * m_y0);
+  float h1 = m_y1 / std::sqrt(d * d + m_y1 * m_y1);
+  float hv = h0 + u.y * (h1 - h0);
+  float yv = hv * hv < 1 - 1e-6f ? hv * d / std::sqrt(1 - hv * hv) : m_y1;
+  yv = std::clamp(yv, m_y0, m_y1);
+
+  glm::vec3 offset = xu * m_x + yv * m_y + m_z0 * m_z;
+  // The pdf is 1 / solidAngle; converting the light's average over its area
+  // into solid angle cancels the emitter's foreshortening
+  weight = m_solidAngle * glm::dot(offset, offset) / m_area;
+  return m_point + offset;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "utils/scenedata.h"
+#include <glm/glm.hpp>
+
+// A rectangular area light as seen from one shading point.
+
+// The light is one-sided: light.pos is its centre, light.dir the direction
+// it faces, and light.width and light.height the lengths of its sides. The
+// width runs horizontally, or along z for lights facing straight up or down.
+//
+// Points are sampled uniformly over the solid angle the rectangle subtends
+// (Urena et al. 2013, "An Area-Preserving Parametrization for Spherical
+// Rectangles"). Stratified input points stay stratified on the light, and
+// there is no variance from distance or foreshortening, only from visibility
+// and the BRDF.
+
+class AreaLight {
+public:
+  AreaLight(const SceneLightData &light, glm::vec3 point);
+
+  // Returns false if the point is behind the light or the light has no area.
+  bool isFacing() const;
+
+  // Maps u in [0, 1)^2 to a point on the light. weight scales the light's
+  // color to that of a point light at the returned position, so that the
+  // average over samples of the point lights' shading is the light's
+  // contribution.
+  glm::vec3 sample(glm::vec2 u, float &weight) const;
+
+private:
+  glm::vec3 m_point;
+  glm::vec3 m_corner;
+  glm::vec3 m_edgeX;
+  glm::vec3 m_edgeY;
+  glm::vec3 m_normal;
+  float m_area;
+  bool m_facing;
+
+  // The spherical rectangle, in a frame at m_point with axes along the
+  // light's edges and z away from the light
+  bool m_solidAngleSampling;
+  glm::vec3 m_x, m_y, m_z;
+  float m_z0;
+  float m_x0, m_y0, m_x1, m_y1;
+  float m_b0, m_b1, m_k;
+  float m_solidAngle;
+};
@@ -0,0 +1,169 @@
+#include "lightindex.h"
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Bounds on the grid's size, and on how many cells one light may occupy
+// before it's cheaper to visit it everywhere
+constexpr int MAX_CELLS_PER_AXIS = 128;
+constexpr int MIN_CELL_BUDGET = 4096;
+constexpr int CELLS_PER_LIGHT = 16;
+constexpr int MAX_CELLS_PER_LIGHT = 512;
+
+} // namespace
+
+float LightIndex::cutoffRadius(const SceneLightData &light, float cutoff) {
+  constexpr float infinity = std::numeric_limits<float>::infinity();
+  // A spot light's diffuse term isn't attenuated by distance, only its
+  // specular term, so it reaches as far as a directional light
+  if (light.type == LightType::LIGHT_DIRECTIONAL ||
+      light.type == LightType::LIGHT_SPOT || cutoff <= 0) {
+    return infinity;
+  }
+  float intensity = std::max({light.color.r, light.color.g, light.color.b});
+  if (intensity <= 0) {
+    return 0;
+  }
+  // Attenuation is 1 / (c0 + c1 d + c2 d^2); find where it reaches
+  // cutoff / intensity. A falloff that ever decreases is left unbounded.
+  float c0 = light.function[0];
+  float c1 = light.function[1];
+  float c2 = light.function[2];
+  if (c1 < 0 || c2 < 0) {
+    return infinity;
+  }
+  float k = intensity / cutoff - c0;
+  float radius;
+  if (k <= 0) {
+    radius = 0;
+  } else if (c2 > 0) {
+    radius = (-c1 + std::sqrt(c1 * c1 + 4 * c2 * k)) / (2 * c2);
+  } else if (c1 > 0) {
+    radius = k / c1;
+  } else {
+    return infinity;
+  }
+  if (light.type == LightType::LIGHT_AREA) {
+    // Distances are measured from points on the light, not its centre
+    radius += 0.5f * std::sqrt(light.width * light.width +
+                               light.height * light.height);
+  }
+  return radius;
+}
+
+LightIndex::LightIndex(const std::vector<SceneLightData> &lights,
+                       float cutoff) {
+  int count = lights.size();
+  m_centres.resize(count);
+  m_radii2.resize(count);
+  std::vector<int> bounded;
+  std::vector<float> radii;
+  for (int l = 0; l < count; l++) {
+    float radius = cutoffRadius(lights[l], cutoff);
+    m_centres[l] = glm::vec3(lights[l].pos);
+    m_radii2[l] = radius * radius;
+    if (std::isinf(radius)) {
+      m_global.push_back(l);
+    } else if (radius > 0) {
+      bounded.push_back(l);
+      radii.push_back(radius);
+    }
+    // Lights with no reach at all are never visited
+  }
+  if (bounded.empty()) {
+    return;
+  }
+
+  glm::vec3 lower(std::numeric_limits<float>::infinity());
+  glm::vec3 upper(-std::numeric_limits<float>::infinity());
+  for (int b = 0; b < bounded.size(); b++) {
+    lower = glm::min(lower, m_centres[bounded[b]] - radii[b]);
+    upper = glm::max(upper, m_centres[bounded[b]] + radii[b]);
+  }
+  glm::vec3 extent = upper - lower;
+  float longest = std::max({extent.x, extent.y, extent.z});
+
+  // Cells about as wide as a typical light's reach, so each light covers a
+  // few of them, unless that makes the grid too big
+  std::vector<float> sorted = radii;
+  std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2,
+                   sorted.end());
+  m_cellSize =
+      std::max(sorted[sorted.size() / 2], longest / MAX_CELLS_PER_AXIS);
+  long budget = std::max<long>(MIN_CELL_BUDGET,
+                               static_cast<long>(CELLS_PER_LIGHT) * count);
+  for (;;) {
+    m_dims = glm::max(glm::ivec3(glm::ceil(extent / m_cellSize)), 1);
+    if (static_cast<long>(m_dims.x) * m_dims.y * m_dims.z <= budget) {
+      break;
+    }
+    m_cellSize *= 1.25f;
+  }
+  m_origin = lower;
+  int cells = m_dims.x * m_dims.y * m_dims.z;
+
+  // Lists the cells each light's sphere touches, first counting them per
+  // cell and then filling them in, which keeps every list in light order
+  auto forEachCell = [&](int b, auto &&fn) {
+    glm::vec3 centre = m_centres[bounded[b]];
+    float radius = radii[b] + 1e-3f * m_cellSize;
+    glm::ivec3 low = glm::clamp(
+        glm::ivec3(glm::floor((centre - radius - m_origin) / m_cellSize)),
+        glm::ivec3(0), m_dims - 1);
+    glm::ivec3 high = glm::clamp(
+        glm::ivec3(glm::floor((centre + radius - m_origin) / m_cellSize)),
+        glm::ivec3(0), m_dims - 1);
+    for (int z = low.z; z <= high.z; z++) {
+      for (int y = low.y; y <= high.y; y++) {
+        for (int x = low.x; x <= high.x; x++) {
+          glm::vec3 cellLower = m_origin + glm::vec3(x, y, z) * m_cellSize;
+          glm::vec3 nearest =
+              glm::clamp(centre, cellLower, cellLower + m_cellSize);
+          glm::vec3 offset = nearest - centre;
+          if (glm::dot(offset, offset) <= radius * radius) {
+            fn((z * m_dims.y + y) * m_dims.x + x);
+          }
+        }
+      }
+    }
+  };
+  std::vector<bool> inGrid(bounded.size());
+  m_cellStarts.assign(cells + 1, 0);
+  for (int b = 0; b < bounded.size(); b++) {
+    int touched = 0;
+    forEachCell(b, [&](int) { touched++; });
+    inGrid[b] = touched <= MAX_CELLS_PER_LIGHT;
+    if (inGrid[b]) {
+      forEachCell(b, [&](int cell) { m_cellStarts[cell + 1]++; });
+    } else {
+      m_global.push_back(bounded[b]);
+    }
+  }
+  std::sort(m_global.begin(), m_global.end());
+  for (int c = 0; c < cells; c++) {
+    m_cellStarts[c + 1] += m_cellStarts[c];
+  }
+  m_cellLights.resize(m_cellStarts[cells]);
+  std::vector<std::uint32_t> next(m_cellStarts.begin(), m_cellStarts.end() - 1);
+  for (int b = 0; b < bounded.size(); b++) {
+    if (inGrid[b]) {
+      forEachCell(b,
+                  [&](int cell) { m_cellLights[next[cell]++] = bounded[b]; });
+    }
+  }
+}
+
+int LightIndex::cellOf(const glm::vec3 &point) const {
+  if (m_cellStarts.empty()) {
+    return -1;
+  }
+  // Compare before converting, as far points overflow an int
+  glm::vec3 position = glm::floor((point - m_origin) / m_cellSize);
+  if (!glm::all(glm::greaterThanEqual(position, glm::vec3(0))) ||
+      !glm::all(glm::lessThan(position, glm::vec3(m_dims)))) {
+    return -1;
+  }
+  glm::ivec3 cell(position);
+  return (cell.z * m_dims.y + cell.y) * m_dims.x + cell.x;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "utils/scenedata.h"
+#include <algorithm>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// The lights of a scene, indexed by where they can light anything.
+
+// A point or area light's falloff, light.function, bounds its reach: past
+// its cutoff radius the light's color times its attenuation drops below the
+// cutoff. Lights with a finite reach go into a uniform grid over their
+// bounding spheres, so a shading point only looks at the lights of its cell.
+// Directional and spot lights, lights that never fall off and lights that
+// reach most of the grid are visited everywhere.
+//
+// Culling darkens the image a little, by the tails of the lights it skips,
+// which add up where many lights overlap. A cutoff of zero keeps every light.
+
+class LightIndex {
+public:
+  // A quarter of an 8-bit step
+  static constexpr float DEFAULT_CUTOFF = 0.25f / 255;
+
+  LightIndex() = default;
+  LightIndex(const std::vector<SceneLightData> &lights,
+             float cutoff = DEFAULT_CUTOFF);
+
+  // Returns the distance past which light contributes less than cutoff, or
+  // infinity if it never does.
+  static float cutoffRadius(const SceneLightData &light, float cutoff);
+
+  // Calls visit with the index of every light that may reach point, in
+  // increasing order.
+  template <typename Visit>
+  void forEachLight(const glm::vec3 &point, Visit &&visit) const;
+
+private:
+  // Returns the grid cell holding point, or -1 outside the grid.
+  int cellOf(const glm::vec3 &point) const;
+
+  // Light centres and cutoff radii, squared; infinite for unbounded lights
+  std::vector<glm::vec3> m_centres;
+  std::vector<float> m_radii2;
+
+  // Lights to visit wherever the point is
+  std::vector<int> m_global;
+
+  // The grid, with the lights of cell c at
+  // m_cellLights[m_cellStarts[c]..m_cellStarts[c + 1]), in increasing order
+  glm::vec3 m_origin{0, 0, 0};
+  float m_cellSize = 1;
+  glm::ivec3 m_dims{0, 0, 0};
+  std::vector<std::uint32_t> m_cellStarts;
+  std::vector<int> m_cellLights;
+};
+
+template <typename Visit>
+void LightIndex::forEachLight(const glm::vec3 &point, Visit &&visit) const {
+  const int *cellBegin = nullptr;
+  const int *cellEnd = nullptr;
+  int cell = cellOf(point);
+  if (cell >= 0) {
+    cellBegin = m_cellLights.data() + m_cellStarts[cell];
+    cellEnd = m_cellLights.data() + m_cellStarts[cell + 1];
+  }
+  const int *globalBegin = m_global.data();
+  const int *globalEnd = globalBegin + m_global.size();
+
+  // Merge both lists so lights are shaded in scene order, as without culling
+  while (cellBegin != cellEnd || globalBegin != globalEnd) {
+    int l;
+    if (globalBegin == globalEnd ||
+        (cellBegin != cellEnd && *cellBegin < *globalBegin)) {
+      l = *cellBegin++;
+    } else {
+      l = *globalBegin++;
+    }
+    glm::vec3 offset = point - m_centres[l];
+    if (glm::dot(offset, offset) <= m_radii2[l]) {
+      visit(l);
+    }
+  }
+}
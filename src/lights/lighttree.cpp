@@ -0,0 +1,192 @@
+#include "lighttree.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr float PI = 3.14159265f;
+
+// Phong's specular term doesn't stop at the horizon, so lights behind the
+// surface keep a little probability
+constexpr float MIN_RECEIVER_COSINE = 0.05f;
+
+float angleBetween(glm::vec3 a, glm::vec3 b) {
+  return std::acos(std::clamp(glm::dot(a, b), -1.0f, 1.0f));
+}
+
+} // namespace
+
+LightTree::LightTree(const std::vector<SceneLightData> &lights) {
+  std::vector<Node> leaves;
+  for (int l = 0; l < lights.size(); l++) {
+    const SceneLightData &light = lights[l];
+    if (light.type == LightType::LIGHT_DIRECTIONAL) {
+      m_unsampled.push_back(l);
+      continue;
+    }
+    m_sampled.push_back(l);
+    Node leaf;
+    leaf.lower = leaf.upper = glm::vec3(light.pos);
+    leaf.axis = glm::vec3(0, 0, 1);
+    leaf.normalAngle = PI;
+    leaf.emissionAngle = PI / 2;
+    leaf.power = std::max({light.color.r, light.color.g, light.color.b, 0.0f});
+    leaf.falloff = light.function;
+    leaf.right = -1;
+    leaf.light = l;
+    if (light.type == LightType::LIGHT_SPOT) {
+      // Only the cone lights anything, and its diffuse term doesn't fall off
+      leaf.axis = glm::normalize(glm::vec3(light.dir));
+      leaf.normalAngle = 0;
+      leaf.emissionAngle = std::min(light.angle, PI);
+      leaf.falloff = glm::vec3(1, 0, 0);
+    } else if (light.type == LightType::LIGHT_AREA) {
+      glm::vec3 halfExtent(0.5f * std::max(light.width, light.height));
+      leaf.lower -= halfExtent;
+      leaf.upper += halfExtent;
+      leaf.axis = glm::normalize(glm::vec3(light.dir));
+      // Shading scales samples by solid angle, so from afar the light is
+      // as bright as a point light of its color, whatever its size
+      leaf.normalAngle = 0;
+    }
+    leaves.push_back(leaf);
+  }
+  if (!leaves.empty()) {
+    m_nodes.reserve(2 * leaves.size() - 1);
+    build(leaves, 0, leaves.size());
+  }
+}
+
+int LightTree::build(std::vector<Node> &leaves, int begin, int end) {
+  int index = m_nodes.size();
+  if (end - begin == 1) {
+    m_nodes.push_back(leaves[begin]);
+    return index;
+  }
+
+  // Split at the median along the longest axis of the lights' centres
+  glm::vec3 lower = 0.5f * (leaves[begin].lower + leaves[begin].upper);
+  glm::vec3 upper = lower;
+  for (int i = begin + 1; i < end; i++) {
+    glm::vec3 centre = 0.5f * (leaves[i].lower + leaves[i].upper);
+    lower = glm::min(lower, centre);
+    upper = glm::max(upper, centre);
+  }
+  glm::vec3 extent = upper - lower;
+  int axis = extent.x >= extent.y && extent.x >= extent.z ? 0
+             : extent.y >= extent.z                       ? 1
+                                                          : 2;
+  int middle = (begin + end) / 2;
+  std::nth_element(leaves.begin() + begin, leaves.begin() + middle,
+                   leaves.begin() + end, [axis](const Node &a, const Node &b) {
+                     return a.lower[axis] + a.upper[axis] <
+                            b.lower[axis] + b.upper[axis];
+                   });
+
+  m_nodes.emplace_back();
+  int left = build(leaves, begin, middle);
+  int right = build(leaves, middle, end);
+  const Node &a = m_nodes[left];
+  const Node &b = m_nodes[right];
+  Node node;
+  node.lower = glm::min(a.lower, b.lower);
+  node.upper = glm::max(a.upper, b.upper);
+  node.power = a.power + b.power;
+  node.falloff = glm::min(a.falloff, b.falloff);
+  node.emissionAngle = std::max(a.emissionAngle, b.emissionAngle);
+  node.right = right;
+  node.light = -1;
+
+  // The smallest cone around both children's cones of facings
+  const Node &wide = a.normalAngle >= b.normalAngle ? a : b;
+  const Node &narrow = a.normalAngle >= b.normalAngle ? b : a;
+  float between = angleBetween(wide.axis, narrow.axis);
+  node.axis = wide.axis;
+  node.normalAngle = wide.normalAngle;
+  if (std::min(between + narrow.normalAngle, PI) > wide.normalAngle) {
+    float angle = 0.5f * (wide.normalAngle + between + narrow.normalAngle);
+    if (angle >= PI) {
+      node.normalAngle = PI;
+    } else {
+      // Turn the wide axis towards the narrow one to centre the new cone
+      glm::vec3 ortho =
+          narrow.axis - glm::dot(wide.axis, narrow.axis) * wide.axis;
+      float turn = angle - wide.normalAngle;
+      node.axis = glm::normalize(std::cos(turn) * wide.axis +
+                                 std::sin(turn) * glm::normalize(ortho));
+      node.normalAngle = angle;
+    }
+  }
+  m_nodes[index] = node;
+  return index;
+}
+
+int LightTree::size() const { return m_sampled.size(); }
+
+const std::vector<int> &LightTree::unsampled() const { return m_unsampled; }
+
+const std::vector<int> &LightTree::sampled() const { return m_sampled; }
+
+float LightTree::importance(const Node &node, glm::vec3 point,
+                            glm::vec3 normal) {
+  glm::vec3 centre = 0.5f * (node.lower + node.upper);
+  float radius = 0.5f * glm::distance(node.lower, node.upper);
+  glm::vec3 toPoint = point - centre;
+  float distance = glm::length(toPoint);
+
+  float orientation = 1;
+  float receiver = 1;
+  if (distance > radius) {
+    // The angles the bounds subtend can loosen both cones
+    float spread = std::asin(radius / distance);
+    glm::vec3 direction = toPoint / distance;
+    float emitted = std::max(
+        0.0f, angleBetween(node.axis, direction) - node.normalAngle - spread);
+    if (emitted >= node.emissionAngle) {
+      return 0;
+    }
+    orientation = std::max(std::cos(emitted), 0.0f);
+    float incident =
+        std::max(0.0f, angleBetween(normal, -direction) - spread);
+    receiver = std::max(std::cos(incident), MIN_RECEIVER_COSINE);
+  }
+
+  float d = std::max(distance, radius);
+  float attenuation = std::min(
+      1.0f, 1.0f / (node.falloff[0] + node.falloff[1] * d +
+                    node.falloff[2] * d * d));
+  return node.power * attenuation * orientation * receiver;
+}
+
+int LightTree::sample(glm::vec3 point, glm::vec3 normal, float u,
+                      float &probability) const {
+  probability = 0;
+  if (m_nodes.empty() || importance(m_nodes[0], point, normal) <= 0) {
+    return -1;
+  }
+  float p = 1;
+  int index = 0;
+  while (m_nodes[index].right >= 0) {
+    int left = index + 1;
+    int right = m_nodes[index].right;
+    float leftWeight = importance(m_nodes[left], point, normal);
+    float rightWeight = importance(m_nodes[right], point, normal);
+    if (leftWeight + rightWeight <= 0) {
+      return -1;
+    }
+    // Pick a child, and rescale u to pick within it
+    float leftProbability = leftWeight / (leftWeight + rightWeight);
+    if (u < leftProbability) {
+      u /= leftProbability;
+      p *= leftProbability;
+      index = left;
+    } else {
+      u = (u - leftProbability) / (1 - leftProbability);
+      p *= 1 - leftProbability;
+      index = right;
+    }
+    u = std::min(u, 0x1.fffffep-1f);
+  }
+  probability = p;
+  return m_nodes[index].light;
+}
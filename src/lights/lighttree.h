@@ -0,0 +1,67 @@
+#pragma once
+
+#include "utils/scenedata.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// A bounding volume hierarchy over a scene's point, spot and area lights,
+// for picking a few lights at random instead of shading all of them.
+
+// Every node keeps the bounds of its lights, their total power and a cone
+// bounding the directions they emit in (Conty Estevez and Kulla 2018,
+// "Importance Sampling of Many Lights with Adaptive Tree Splitting"). Picking
+// a light walks from the root, choosing each child in proportion to an
+// estimate of how much it could add at the shading point. The estimate never
+// rules out a light that can reach the point, so dividing a light's
+// contribution by its probability keeps the average exact. Directional
+// lights aren't in the tree and are always shaded.
+
+class LightTree {
+public:
+  LightTree() = default;
+  LightTree(const std::vector<SceneLightData> &lights);
+
+  // Returns how many lights are in the tree.
+  int size() const;
+
+  // Returns the indices of the lights left out of the tree.
+  const std::vector<int> &unsampled() const;
+
+  // Returns the indices of the lights in the tree.
+  const std::vector<int> &sampled() const;
+
+  // Picks a light for a point with the given normal, mapping u in [0, 1) to
+  // a light with probability proportional to its estimated contribution.
+  // Returns its index among the scene's lights, or -1 if no light can reach
+  // the point.
+  int sample(glm::vec3 point, glm::vec3 normal, float u,
+             float &probability) const;
+
+private:
+  struct Node {
+    glm::vec3 lower;
+    glm::vec3 upper;
+    // The cone of emitted directions: every light faces within angle
+    // normalAngle of axis, and emits within emissionAngle of its facing
+    glm::vec3 axis;
+    float normalAngle;
+    float emissionAngle;
+    float power;
+    // The smallest coefficients of the lights' falloffs
+    glm::vec3 falloff;
+    // The second child; the first follows the node. -1 for a leaf.
+    int right;
+    int light;
+  };
+
+  // Builds the subtree over lights[begin, end) and returns its root.
+  int build(std::vector<Node> &leaves, int begin, int end);
+
+  // Returns an estimate of how much node's lights can add at point.
+  static float importance(const Node &node, glm::vec3 point,
+                          glm::vec3 normal);
+
+  std::vector<Node> m_nodes;
+  std::vector<int> m_sampled;
+  std::vector<int> m_unsampled;
+};
@@ -0,0 +1,93 @@
+#include "accumulationbuffer.h"
+#include "raytracer.h"
+#include <cmath>
+
+AccumulationBuffer::AccumulationBuffer(int width, int height, bool withGuides)
+    : m_width(width), m_height(height), m_pixels(std::size_t(width) * height) {
+  if (withGuides) {
+    m_guides.resize(std::size_t(width) * height);
+  }
+}
+
+int AccumulationBuffer::width() const { return m_width; }
+
+int AccumulationBuffer::height() const { return m_height; }
+
+void AccumulationBuffer::add(int x, int y, const glm::vec4 &color,
+                             const PixelGuides &guides) {
+  glm::vec3 displayed = glm::clamp(glm::vec3(color), 0.0f, 1.0f);
+  float luminance =
+      glm::dot(displayed, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+  Pixel &pixel = m_pixels[y * m_width + x];
+  pixel.sum += color;
+  pixel.count++;
+  // Welford's update, which stays accurate over many samples
+  float delta = luminance - pixel.luminanceMean;
+  pixel.luminanceMean += delta / pixel.count;
+  pixel.luminanceM2 += delta * (luminance - pixel.luminanceMean);
+
+  if (m_guides.empty()) {
+    return;
+  }
+  Guides &sums = m_guides[y * m_width + x];
+  if (pixel.count == 1) {
+    // The first pass goes through the pixel centre
+    sums.primitive = guides.primitive;
+  }
+  sums.albedo += guides.albedo;
+  if (guides.primitive != -1) {
+    sums.normal += guides.normal;
+    sums.depth += guides.depth;
+    sums.hits++;
+  }
+}
+
+glm::vec4 AccumulationBuffer::mean(int x, int y) const {
+  const Pixel &pixel = m_pixels[y * m_width + x];
+  if (pixel.count == 0) {
+    return glm::vec4(0, 0, 0, 0);
+  }
+  return pixel.sum / static_cast<float>(pixel.count);
+}
+
+int AccumulationBuffer::sampleCount(int x, int y) const {
+  return m_pixels[y * m_width + x].count;
+}
+
+float AccumulationBuffer::standardError(int x, int y) const {
+  const Pixel &pixel = m_pixels[y * m_width + x];
+  if (pixel.count < 2) {
+    return INFINITY;
+  }
+  float variance = pixel.luminanceM2 / (pixel.count - 1);
+  return std::sqrt(variance / pixel.count);
+}
+
+void AccumulationBuffer::resolve(RGBA *imageData) const {
+  for (int i = 0; i < m_width * m_height; i++) {
+    const Pixel &pixel = m_pixels[i];
+    imageData[i] = pixel.count == 0
+                       ? RGBA{0, 0, 0, 255}
+                       : toRGBA(pixel.sum / static_cast<float>(pixel.count));
+  }
+}
+
+void AccumulationBuffer::resolve(FrameBuffer &frame) const {
+  for (int y = 0; y < m_height; y++) {
+    for (int x = 0; x < m_width; x++) {
+      const Pixel &pixel = m_pixels[y * m_width + x];
+      if (pixel.count == 0) {
+        continue;
+      }
+      frame.color(x, y) = pixel.sum / static_cast<float>(pixel.count);
+      if (m_guides.empty() || !frame.hasGuides()) {
+        continue;
+      }
+      const Guides &sums = m_guides[y * m_width + x];
+      frame.guides(x, y) = PixelGuides{
+          sums.hits > 0 ? glm::normalize(sums.normal) : glm::vec3(0, 0, 0),
+          sums.albedo / static_cast<float>(pixel.count),
+          sums.hits > 0 ? sums.depth / sums.hits : 0, sums.primitive};
+    }
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "framebuffer.h"
+#include "utils/rgba.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+// A float framebuffer that averages the samples added to each pixel.
+
+// Besides the running mean it keeps the variance of each pixel's luminance,
+// so a progressive render can tell how far a pixel's estimate may still be
+// from its converged value, and optionally the denoiser's guides.
+//
+// Nothing locks: the per-pixel methods may be called from several threads at
+// once as long as each pixel is only touched by one of them, as a pass's
+// rows are. Whole-buffer reads such as resolve() must not overlap adds, so
+// progressive renders only make them between passes.
+
+class AccumulationBuffer {
+public:
+  AccumulationBuffer(int width, int height, bool withGuides = false);
+
+  int width() const;
+  int height() const;
+
+  // Adds one sample to pixel (x, y), with what it hit.
+  void add(int x, int y, const glm::vec4 &color, const PixelGuides &guides);
+
+  // Returns the mean of the samples added to pixel (x, y).
+  glm::vec4 mean(int x, int y) const;
+
+  int sampleCount(int x, int y) const;
+
+  // Returns the standard error of the mean luminance of pixel (x, y), or
+  // infinity if it has fewer than two samples. Luminance is taken after
+  // clamping to the displayable range.
+  float standardError(int x, int y) const;
+
+  // Writes the current means into imageData as 8-bit colors.
+  void resolve(RGBA *imageData) const;
+
+  // Writes the current means, and the guides if both buffers keep them, into
+  // frame.
+  void resolve(FrameBuffer &frame) const;
+
+private:
+  struct Pixel {
+    glm::vec4 sum{0, 0, 0, 0};
+    int count = 0;
+    // Running mean and sum of squared deviations of the luminance
+    float luminanceMean = 0;
+    float luminanceM2 = 0;
+  };
+
+  // Guide sums; normal and depth only over samples that hit something
+  struct Guides {
+    glm::vec3 normal{0, 0, 0};
+    glm::vec3 albedo{0, 0, 0};
+    float depth = 0;
+    int hits = 0;
+    int primitive = -1;
+  };
+
+  int m_width;
+  int m_height;
+  std::vector<Pixel> m_pixels;
+  std::vector<Guides> m_guides;
+};
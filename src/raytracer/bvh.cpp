@@ -0,0 +1,206 @@
+#include "bvh.h"
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+// Costs of testing a ray against a node's bounds and against a primitive,
+// which transforms the ray and solves for the hit
+constexpr float TRAVERSAL_COST = 0.25f;
+constexpr float INTERSECTION_COST = 1.0f;
+
+// Splits are chosen among the boundaries of this many centroid bins
+constexpr int BINS = 12;
+
+// Below this depth, subtrees are split in half rather than by cost, so that
+// no tree gets deeper than MAX_DEPTH however its primitives are spread
+constexpr int BALANCED_DEPTH = BVH::MAX_DEPTH - 32;
+
+} // namespace
+
+void BVH::Bounds::grow(const Bounds &other) {
+  lower = glm::min(lower, other.lower);
+  upper = glm::max(upper, other.upper);
+}
+
+float BVH::Bounds::area() const {
+  glm::vec3 extent = upper - lower;
+  if (extent.x < 0 || extent.y < 0 || extent.z < 0) {
+    return 0;
+  }
+  return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+BVH::Bounds BVH::primitiveBounds(const glm::mat4 &ctm) {
+  Bounds bounds;
+  for (int corner = 0; corner < 8; corner++) {
+    glm::vec4 point(corner & 1 ? 0.5f : -0.5f, corner & 2 ? 0.5f : -0.5f,
+                    corner & 4 ? 0.5f : -0.5f, 1);
+    glm::vec3 world(ctm * point);
+    bounds.lower = glm::min(bounds.lower, world);
+    bounds.upper = glm::max(bounds.upper, world);
+  }
+  // Hits are found in object space, so allow for rounding on the way there
+  glm::vec3 padding =
+      1e-5f * (glm::abs(bounds.lower) + glm::abs(bounds.upper)) + 1e-6f;
+  bounds.lower -= padding;
+  bounds.upper += padding;
+  return bounds;
+}
+
+void BVH::build(const std::vector<Bounds> &bounds) {
+  m_nodes.clear();
+  m_primitives.resize(bounds.size());
+  std::iota(m_primitives.begin(), m_primitives.end(), 0);
+  if (!bounds.empty()) {
+    std::vector<glm::vec3> centroids;
+    centroids.reserve(bounds.size());
+    for (const Bounds &b : bounds) {
+      centroids.push_back(0.5f * (b.lower + b.upper));
+    }
+    m_nodes.reserve(2 * bounds.size() - 1);
+    build(bounds, centroids, 0, bounds.size(), 0);
+  }
+  m_builtCost = cost();
+}
+
+int BVH::build(const std::vector<Bounds> &bounds,
+               const std::vector<glm::vec3> &centroids, int begin, int end,
+               int depth) {
+  int index = m_nodes.size();
+  m_nodes.emplace_back();
+  Bounds nodeBounds;
+  Bounds centroidBounds;
+  for (int i = begin; i < end; i++) {
+    int p = m_primitives[i];
+    nodeBounds.grow(bounds[p]);
+    centroidBounds.grow(Bounds{centroids[p], centroids[p]});
+  }
+  m_nodes[index].bounds = nodeBounds;
+
+  int count = end - begin;
+  glm::vec3 extent = centroidBounds.upper - centroidBounds.lower;
+  int axis = extent.x > extent.y && extent.x > extent.z ? 0
+             : extent.y > extent.z                     ? 1
+                                                       : 2;
+  // Primitives at the same centroid can't be told apart
+  if (count == 1 || depth == MAX_DEPTH || extent[axis] <= 0) {
+    m_nodes[index].offset = begin;
+    m_nodes[index].count = count;
+    return index;
+  }
+
+  int middle;
+  if (depth >= BALANCED_DEPTH) {
+    middle = begin + count / 2;
+    std::nth_element(m_primitives.begin() + begin,
+                     m_primitives.begin() + middle,
+                     m_primitives.begin() + end, [&](int a, int b) {
+                       return centroids[a][axis] < centroids[b][axis];
+                     });
+  } else {
+    auto binOf = [&](int p) {
+      float offset = (centroids[p][axis] - centroidBounds.lower[axis]) /
+                     extent[axis];
+      return std::min(static_cast<int>(offset * BINS), BINS - 1);
+    };
+    Bounds binBounds[BINS];
+    int binCounts[BINS] = {};
+    for (int i = begin; i < end; i++) {
+      int p = m_primitives[i];
+      int bin = binOf(p);
+      binBounds[bin].grow(bounds[p]);
+      binCounts[bin]++;
+    }
+
+    // The cost of splitting after each bin, relative to the node's area
+    float aboveAreas[BINS];
+    int aboveCounts[BINS];
+    Bounds above;
+    int aboveCount = 0;
+    for (int bin = BINS - 1; bin > 0; bin--) {
+      above.grow(binBounds[bin]);
+      aboveCount += binCounts[bin];
+      aboveAreas[bin - 1] = above.area();
+      aboveCounts[bin - 1] = aboveCount;
+    }
+    Bounds below;
+    int belowCount = 0;
+    float bestCost = INFINITY;
+    int bestSplit = 0;
+    for (int split = 0; split < BINS - 1; split++) {
+      below.grow(binBounds[split]);
+      belowCount += binCounts[split];
+      float cost = below.area() * belowCount +
+                   aboveAreas[split] * aboveCounts[split];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestSplit = split;
+      }
+    }
+    bestCost = TRAVERSAL_COST +
+               INTERSECTION_COST * bestCost / std::max(nodeBounds.area(),
+                                                       1e-30f);
+    if (bestCost >= INTERSECTION_COST * count) {
+      m_nodes[index].offset = begin;
+      m_nodes[index].count = count;
+      return index;
+    }
+    // The first and last bins both hold a primitive, so neither side is empty
+    middle = std::partition(m_primitives.begin() + begin,
+                            m_primitives.begin() + end,
+                            [&](int p) { return binOf(p) <= bestSplit; }) -
+             m_primitives.begin();
+  }
+
+  build(bounds, centroids, begin, middle, depth + 1);
+  int second = build(bounds, centroids, middle, end, depth + 1);
+  m_nodes[index].offset = second;
+  m_nodes[index].count = 0;
+  return index;
+}
+
+void BVH::refit(const std::vector<Bounds> &bounds) {
+  // Children come after their parents
+  for (int index = static_cast<int>(m_nodes.size()) - 1; index >= 0; index--) {
+    Node &node = m_nodes[index];
+    node.bounds = Bounds();
+    if (node.count > 0) {
+      for (int i = node.offset; i < node.offset + node.count; i++) {
+        node.bounds.grow(bounds[m_primitives[i]]);
+      }
+    } else {
+      node.bounds.grow(m_nodes[index + 1].bounds);
+      node.bounds.grow(m_nodes[node.offset].bounds);
+    }
+  }
+}
+
+float BVH::cost() const {
+  if (m_nodes.empty()) {
+    return 0;
+  }
+  // A ray through the root passes through each node with a probability of
+  // their ratio of areas
+  float cost = 0;
+  for (const Node &node : m_nodes) {
+    cost += node.bounds.area() *
+            (node.count > 0 ? INTERSECTION_COST * node.count : TRAVERSAL_COST);
+  }
+  return cost / std::max(m_nodes[0].bounds.area(), 1e-30f);
+}
+
+float BVH::entry(const Bounds &bounds, const glm::vec3 &origin,
+                 const glm::vec3 &inverseDirection) {
+  // An axis the ray runs along the edge of gives NaN, which std::min and
+  // std::max pass over when it's their second argument
+  float near = 0;
+  float far = INFINITY;
+  for (int axis = 0; axis < 3; axis++) {
+    float t1 = (bounds.lower[axis] - origin[axis]) * inverseDirection[axis];
+    float t2 = (bounds.upper[axis] - origin[axis]) * inverseDirection[axis];
+    near = std::max(near, std::min(t1, t2));
+    far = std::min(far, std::max(t1, t2));
+  }
+  return near <= far ? near : INFINITY;
+}
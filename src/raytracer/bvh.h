@@ -0,0 +1,125 @@
+#pragma once
+
+#include "ray.hpp"
+#include <glm/glm.hpp>
+#include <utility>
+#include <vector>
+
+// A bounding volume hierarchy over a scene's primitives, so that a ray is only
+// tested against the primitives whose bounds it passes through.
+
+// The tree is built top-down with the surface area heuristic, choosing each
+// split among a few bins of the primitives' centroids along the widest axis.
+// When primitives only move, as between the frames of an animation, refitting
+// recomputes the nodes' bounds bottom-up and keeps the tree. That's far
+// cheaper than a build, but the tree degrades as primitives drift from the
+// neighbours they were grouped with; its heuristic cost measures by how much,
+// so its owner can rebuild once the cost has grown past a threshold.
+
+class BVH {
+public:
+  // An axis-aligned box. An empty box has lower above upper.
+  struct Bounds {
+    glm::vec3 lower = glm::vec3(INFINITY);
+    glm::vec3 upper = glm::vec3(-INFINITY);
+
+    void grow(const Bounds &other);
+    float area() const;
+  };
+
+  // The deepest a built tree gets
+  static constexpr int MAX_DEPTH = 64;
+
+  // Rebuild once refitting has grown the cost by this factor
+  static constexpr float DEFAULT_REBUILD_THRESHOLD = 1.5f;
+
+  // Returns the world bounds of a unit primitive, which fits in the cube from
+  // -0.5 to 0.5, transformed by ctm.
+  static Bounds primitiveBounds(const glm::mat4 &ctm);
+
+  BVH() = default;
+
+  // Builds the tree over primitives with the given bounds.
+  void build(const std::vector<Bounds> &bounds);
+
+  // Updates the tree's bounds to the primitives' new ones, keeping its shape.
+  // There must be as many as it was built over.
+  void refit(const std::vector<Bounds> &bounds);
+
+  // Returns the expected cost of tracing a ray through the tree, and what it
+  // was when last built.
+  float cost() const;
+  float builtCost() const { return m_builtCost; }
+
+  // Calls visit(p) for each primitive p whose bounds ray enters before maxT,
+  // roughly nearest first. visit may lower maxT, as the closest hit so far
+  // does, to skip what lies beyond it, and returns true to stop.
+  template <typename Visit>
+  void traverse(const Ray &ray, const float &maxT, Visit &&visit) const;
+
+private:
+  struct Node {
+    Bounds bounds;
+    // For a leaf, its first primitive in m_primitives; otherwise the second
+    // child, as the first follows the node
+    int offset;
+    int count; // Primitives in a leaf, 0 otherwise
+  };
+
+  // Builds the subtree over m_primitives[begin, end), whose root is at depth,
+  // and returns its root.
+  int build(const std::vector<Bounds> &bounds,
+            const std::vector<glm::vec3> &centroids, int begin, int end,
+            int depth);
+
+  // Returns where ray enters bounds, or INFINITY if it misses them.
+  static float entry(const Bounds &bounds, const glm::vec3 &origin,
+                     const glm::vec3 &inverseDirection);
+
+  std::vector<Node> m_nodes;
+  std::vector<int> m_primitives;
+  float m_builtCost = 0;
+};
+
+template <typename Visit>
+void BVH::traverse(const Ray &ray, const float &maxT, Visit &&visit) const {
+  if (m_nodes.empty()) {
+    return;
+  }
+  const glm::vec3 inverseDirection = 1.0f / ray.direction;
+  // Each node waits with where the ray enters it, as maxT may have dropped
+  // below that by the time it's reached. The stack holds at most one node
+  // per level, and the build keeps the tree shallow enough.
+  struct Entry {
+    int node;
+    float t;
+  };
+  Entry stack[MAX_DEPTH + 1];
+  int size = 0;
+  stack[size++] = {0, entry(m_nodes[0].bounds, ray.origin, inverseDirection)};
+  while (size > 0) {
+    Entry next = stack[--size];
+    if (next.t == INFINITY || next.t > maxT) {
+      continue;
+    }
+    const Node &node = m_nodes[next.node];
+    if (node.count > 0) {
+      for (int i = node.offset; i < node.offset + node.count; i++) {
+        if (visit(m_primitives[i])) {
+          return;
+        }
+      }
+      continue;
+    }
+    Entry first = {next.node + 1, 0};
+    Entry second = {node.offset, 0};
+    first.t = entry(m_nodes[first.node].bounds, ray.origin, inverseDirection);
+    second.t = entry(m_nodes[second.node].bounds, ray.origin, inverseDirection);
+    // The nearer child is pushed last, to be visited first
+    if (second.t < first.t) {
+      std::swap(first, second);
+    }
+    stack[size++] = second;
+    stack[size++] = first;
+  }
+}
@@ -0,0 +1,158 @@
+#include "framebuffer.h"
+#include "tonemapper.h"
+#include "utils/littleendianwriter.h"
+
+#include <QSaveFile>
+#include <QSysInfo>
+#include <cstdint>
+#include <iostream>
+
+FrameBuffer::FrameBuffer(int width, int height, bool withGuides)
+    : m_width(width), m_height(height),
+      m_color(std::size_t(width) * height, glm::vec4(0, 0, 0, 0)) {
+  if (withGuides) {
+    m_guides.assign(std::size_t(width) * height,
+                    PixelGuides{glm::vec3(0, 0, 0), glm::vec3(0, 0, 0), 0, -1});
+  }
+}
+
+int FrameBuffer::width() const { return m_width; }
+
+int FrameBuffer::height() const { return m_height; }
+
+bool FrameBuffer::hasGuides() const { return !m_guides.empty(); }
+
+glm::vec4 &FrameBuffer::color(int x, int y) { return m_color[y * m_width + x]; }
+
+const glm::vec4 &FrameBuffer::color(int x, int y) const {
+  return m_color[y * m_width + x];
+}
+
+PixelGuides &FrameBuffer::guides(int x, int y) {
+  return m_guides[y * m_width + x];
+}
+
+const PixelGuides &FrameBuffer::guides(int x, int y) const {
+  return m_guides[y * m_width + x];
+}
+
+void FrameBuffer::resolve(RGBA *imageData) const {
+  ToneMapper().resolve(*this, imageData);
+}
+
+static bool commit(QSaveFile &file, const std::string &filename) {
+  if (!file.commit()) {
+    std::cout << "could not write " << filename << ": "
+              << file.errorString().toStdString() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool FrameBuffer::writePFM(const std::string &filename) const {
+  QSaveFile file(QString::fromStdString(filename));
+  if (!file.open(QFile::WriteOnly)) {
+    std::cout << "could not open " << filename << " for writing" << std::endl;
+    return false;
+  }
+
+  // A negative scale marks little-endian data
+  bool littleEndian = QSysInfo::ByteOrder == QSysInfo::LittleEndian;
+  std::string header = "PF\n" + std::to_string(m_width) + " " +
+                       std::to_string(m_height) + "\n" +
+                       (littleEndian ? "-1.0" : "1.0") + "\n";
+  file.write(header.data(), header.size());
+
+  std::vector<float> row(m_width * 3);
+  for (int y = m_height - 1; y >= 0; y--) {
+    for (int x = 0; x < m_width; x++) {
+      const glm::vec4 &c = color(x, y);
+      row[3 * x] = c.r;
+      row[3 * x + 1] = c.g;
+      row[3 * x + 2] = c.b;
+    }
+    file.write(reinterpret_cast<const char *>(row.data()),
+               row.size() * sizeof(float));
+  }
+  return commit(file, filename);
+}
+
+namespace {
+
+// Appends the name, type and size that start an OpenEXR header attribute
+void attribute(LittleEndianWriter &header, const std::string &name,
+               const std::string &type, std::int32_t size) {
+  header.string(name);
+  header.string(type);
+  header.int32(size);
+}
+
+} // namespace
+
+bool FrameBuffer::writeEXR(const std::string &filename) const {
+  QSaveFile file(QString::fromStdString(filename));
+  if (!file.open(QFile::WriteOnly)) {
+    std::cout << "could not open " << filename << " for writing" << std::endl;
+    return false;
+  }
+
+  constexpr std::int32_t FLOAT = 2;
+  // Channels are stored in alphabetical order
+  const char *channels[] = {"B", "G", "R"};
+
+  LittleEndianWriter header;
+  header.uint32(20000630); // Magic number
+  header.uint32(2);        // Version 2, single-part scanline file
+
+  attribute(header, "channels", "chlist", 3 * (2 + 16) + 1);
+  for (const char *channel : channels) {
+    header.string(channel);
+    header.int32(FLOAT);
+    header.uint32(0); // Not perceptually linear, then reserved bytes
+    header.int32(1);  // No subsampling
+    header.int32(1);
+  }
+  header.bytes.push_back('\0');
+  attribute(header, "compression", "compression", 1);
+  header.bytes.push_back('\0'); // No compression
+  for (const char *window : {"dataWindow", "displayWindow"}) {
+    attribute(header, window, "box2i", 16);
+    header.int32(0);
+    header.int32(0);
+    header.int32(m_width - 1);
+    header.int32(m_height - 1);
+  }
+  attribute(header, "lineOrder", "lineOrder", 1);
+  header.bytes.push_back('\0'); // Increasing y
+  attribute(header, "pixelAspectRatio", "float", 4);
+  header.float32(1);
+  attribute(header, "screenWindowCenter", "v2f", 8);
+  header.float32(0);
+  header.float32(0);
+  attribute(header, "screenWindowWidth", "float", 4);
+  header.float32(1);
+  header.bytes.push_back('\0'); // End of header
+
+  // Uncompressed files hold one scanline per chunk, each found through an
+  // offset table after the header
+  std::uint64_t lineBytes = 3ull * m_width * sizeof(float);
+  std::uint64_t chunkBytes = 8 + lineBytes;
+  std::uint64_t firstChunk = header.bytes.size() + 8ull * m_height;
+  for (int y = 0; y < m_height; y++) {
+    header.uint64(firstChunk + y * chunkBytes);
+  }
+  file.write(header.bytes.data(), header.bytes.size());
+
+  for (int y = 0; y < m_height; y++) {
+    LittleEndianWriter chunk;
+    chunk.int32(y);
+    chunk.int32(static_cast<std::int32_t>(lineBytes));
+    for (int c = 2; c >= 0; c--) {
+      for (int x = 0; x < m_width; x++) {
+        chunk.float32(color(x, y)[c]);
+      }
+    }
+    file.write(chunk.bytes.data(), chunk.bytes.size());
+  }
+  return commit(file, filename);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "utils/rgba.h"
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+// What a pixel's camera rays hit first, averaged over its samples. The
+// denoiser uses these to tell noise from real edges.
+struct PixelGuides {
+  glm::vec3 normal; // World space; zero where nothing was hit
+  glm::vec3 albedo; // The diffuse color, textured
+  float depth;      // Along the view axis; zero where nothing was hit
+  int primitive;    // Seen through the pixel centre; -1 for the background
+};
+
+// A rendered image in linear, unclamped float color, with optional guide
+// buffers for the denoiser.
+
+class FrameBuffer {
+public:
+  FrameBuffer(int width, int height, bool withGuides);
+
+  int width() const;
+  int height() const;
+  bool hasGuides() const;
+
+  glm::vec4 &color(int x, int y);
+  const glm::vec4 &color(int x, int y) const;
+
+  PixelGuides &guides(int x, int y);
+  const PixelGuides &guides(int x, int y) const;
+
+  // Clamps the colors to [0, 1] and writes them into imageData.
+  void resolve(RGBA *imageData) const;
+
+  // Writes the colors, unclamped, to a Portable Float Map: 32-bit float RGB
+  // in native byte order, rows bottom to top.
+  bool writePFM(const std::string &filename) const;
+
+  // Writes the colors, unclamped, to an uncompressed scanline OpenEXR file
+  // with 32-bit float R, G and B channels.
+  bool writeEXR(const std::string &filename) const;
+
+private:
+  int m_width;
+  int m_height;
+  std::vector<glm::vec4> m_color;
+  std::vector<PixelGuides> m_guides;
+};
@@ -7,6 +7,14 @@ class Ray {
 public:
   glm::vec3 origin;
   glm::vec3 direction;
+
+  // Ray differentials: how the origin and direction change for the ray
+  // through the neighbouring pixel in x and in y. Only valid when
+  // hasDifferentials is set.
+  bool hasDifferentials = false;
+  glm::vec3 dOdx, dOdy;
+  glm::vec3 dDdx, dDdy;
+
   Ray(){};
   Ray(glm::vec3 origin, glm::vec3 direction) {
     this->origin = origin;
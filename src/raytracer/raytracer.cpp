@@ -1,11 +1,21 @@
 #include "raytracer.h"
+#include "accumulationbuffer.h"
+#include "denoiser/denoiser.h"
 #include "geometry/primitive.h"
+#include "lights/arealight.h"
 #include "ray.hpp"
 #include "raytracescene.h"
+#include "texture/tiledtexture.h"
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cmath>
 #include <iostream>
+#include <vector>
 
-RayTracer::RayTracer(Config config) : m_config(config) {}
+RayTracer::RayTracer(Config config)
+    : m_config(config), m_sampler(config.samplerType, config.samplerSeed) {}
 
 RGBA toRGBA(const glm::vec4 &illumination) {
   uint8_t returnR = 255 * std::min(std::max(illumination[0], 0.0f), 1.0f);
@@ -19,7 +29,8 @@ void RayTracer::calcPhong(const glm::vec3 worldNormal,
                           const glm::vec3 point, const SceneMaterial material,
                           const SceneLightData light, const float ka,
                           const float kd, const float ks,
-                          glm::vec4 &illumination, RGBA curColor, float blend) {
+                          glm::vec4 &illumination, glm::vec4 textureColor,
+                          float blend) {
   switch (light.type) {
   case LightType::LIGHT_DIRECTIONAL: {
     glm::vec3 directionToLight = glm::normalize(-light.dir);
@@ -31,10 +42,7 @@ void RayTracer::calcPhong(const glm::vec3 worldNormal,
     if (diffuseFactor > 0) {
       illumination +=
           diffuseFactor *
-          (blend * glm::vec4(curColor.r / 255.0 * 2.0, curColor.g / 255.0 * 2.0,
-                             curColor.b / 255.0 * 2.0,
-                             curColor.a / 255.0 * 2.0) +
-           material.cDiffuse * (1 - blend)) *
+          (blend * 2.0f * textureColor + material.cDiffuse * (1 - blend)) *
           kd * light.color;
     }
     if (specularFactor > 0) {
@@ -58,10 +66,7 @@ void RayTracer::calcPhong(const glm::vec3 worldNormal,
     if (diffuseFactor > 0) {
       illumination +=
           diffuseFactor *
-          (blend * glm::vec4(curColor.r / 255.0 * 2.0, curColor.g / 255.0 * 2.0,
-                             curColor.b / 255.0 * 2.0,
-                             curColor.a / 255.0 * 2.0) +
-           material.cDiffuse * (1 - blend)) *
+          (blend * 2.0f * textureColor + material.cDiffuse * (1 - blend)) *
           kd * light.color * attenuation;
     }
     if (specularFactor > 0) {
@@ -100,10 +105,7 @@ void RayTracer::calcPhong(const glm::vec3 worldNormal,
     if (diffuseFactor > 0) {
       illumination +=
           diffuseFactor *
-          (blend * glm::vec4(curColor.r / 255.0 * 2.0, curColor.g / 255.0 * 2.0,
-                             curColor.b / 255.0 * 2.0,
-                             curColor.a / 255.0 * 2.0) +
-           material.cDiffuse * (1 - blend)) *
+          (blend * 2.0f * textureColor + material.cDiffuse * (1 - blend)) *
           kd * light.color * attenuation;
     }
     if (specularFactor > 0) {
@@ -118,201 +120,883 @@ void RayTracer::calcPhong(const glm::vec3 worldNormal,
   }
 }
 
-glm::vec4 RayTracer::traceRay(Ray &reflectedRayInWorld,
-                              const RayTraceScene &scene, glm::vec3 cameraPos,
-                              std::vector<glm::mat4> CTMs,
-                              std::vector<glm::mat4> inverseCTMs,
-                              std::vector<glm::mat3> transInverses,
-                              std::vector<SceneLightData> lights,
-                              std::vector<Primitive *> primitives, float ka,
-                              float kd, float ks, int depth) {
-  if (depth == 0) {
-    return glm::vec4(0, 0, 0, 0);
+void RayTracer::addAreaLight(const SceneLightData &light,
+                             const glm::vec3 worldNormal,
+                             const glm::vec3 directionToCamera,
+                             const glm::vec3 point,
+                             const SceneMaterial &material, const float ka,
+                             const float kd, const float ks,
+                             glm::vec4 &illumination, glm::vec4 textureColor,
+                             const RayTraceScene &scene,
+                             const PixelSample &pixel, int lightIndex,
+                             int dimension) {
+  AreaLight areaLight(light, point);
+  if (!areaLight.isFacing()) {
+    return;
   }
-  float smallestT = INFINITY;
-  glm::vec3 worldIntersectionPoint;
-  glm::vec4 myIllumination(0, 0, 0, 0);
-  for (int p = 0; p < primitives.size(); p++) {
-    Primitive *primitive = primitives[p];
-    Ray ray(inverseCTMs[p] * glm::vec4(reflectedRayInWorld.origin, 1),
-            inverseCTMs[p] * glm::vec4(reflectedRayInWorld.direction, 0));
-    float t = primitive->intersect(ray);
-    if (t > 0 && t < smallestT) {
-      smallestT = t;
-      SceneMaterial material = primitive->getMaterial();
-      glm::vec3 objectPoint =
-          inverseCTMs[p] * glm::vec4(reflectedRayInWorld.origin, 1) +
-          t * inverseCTMs[p] * glm::vec4(reflectedRayInWorld.direction, 0);
-      glm::vec3 normal = primitive->getNormal(objectPoint);
-      glm::mat3 invTrans = transInverses[p];
-      glm::vec3 worldNormal = glm::normalize(invTrans * normal);
-      glm::vec3 directionToCamera = glm::normalize(cameraPos - objectPoint);
-      myIllumination = glm::vec4(0, 0, 0, 0);
-      myIllumination += material.cAmbient * ka;
-      for (int l = 0; l < lights.size(); l++) {
-        SceneLightData light = lights[l];
-        worldIntersectionPoint = CTMs[p] * glm::vec4(objectPoint, 1);
-        glm::vec3 shadowRayDirection = glm::vec3(0, 0, 0);
-        if (light.type == LightType::LIGHT_POINT ||
-            light.type == LightType::LIGHT_SPOT) {
-          shadowRayDirection =
-              glm::normalize(glm::vec3(light.pos) - worldIntersectionPoint);
-        } else {
-          shadowRayDirection = -glm::normalize(glm::vec3(light.dir));
-        }
-        Ray shadowRay =
-            Ray(worldIntersectionPoint + 0.001f * shadowRayDirection,
-                shadowRayDirection);
-        bool obstructed = false;
-        for (int p = 0; p < primitives.size(); p++) {
-          Primitive *primitive = primitives[p];
-          Ray shadowRayObject =
-              Ray(inverseCTMs[p] * glm::vec4(shadowRay.origin, 1),
-                  inverseCTMs[p] * glm::vec4(shadowRay.direction, 0));
-          float t = primitive->intersect(shadowRayObject);
-          if (t > 0) {
-            obstructed = true;
-            break;
-          }
-        }
-        if (!obstructed) {
-          RGBA curColor = primitive->getTextureColor(objectPoint);
-          float blend = material.blend;
-          calcPhong(worldNormal, directionToCamera, worldIntersectionPoint,
-                    material, light, ka, kd, ks, myIllumination, curColor,
-                    blend);
-        }
+  // Each camera sample gets its own aligned block of the sequence, so every
+  // power-of-four prefix of its light samples stays stratified
+  std::uint32_t stride = std::bit_ceil(
+      static_cast<std::uint32_t>(std::max(m_config.maxAreaLightSamples, 1)));
+  std::uint32_t first = pixel.index * stride;
+
+  // Each sample shades like a point light at a point on the light
+  SceneLightData pointLight = light;
+  pointLight.type = LightType::LIGHT_POINT;
+  glm::vec4 sum(0, 0, 0, 0);
+  int taken = 0;
+  int visible = 0;
+  for (int total = std::max(m_config.areaLightSamples, 1);; total *= 4) {
+    for (; taken < total; taken++) {
+      float weight;
+      glm::vec3 position = areaLight.sample(
+          m_sampler.get2D(pixel.x, pixel.y, first + taken, dimension), weight);
+      glm::vec3 toLight = position - point;
+      Ray shadowRay(point + 0.001f * glm::normalize(toLight), toLight);
+      if (isOccluded(shadowRay, scene, 1 - 1e-3f, lightIndex)) {
+        continue;
       }
-      if (depth >= 1 && material.cReflective != glm::vec4(0, 0, 0, 0)) {
-        Ray reflectedRay =
-            Ray(worldIntersectionPoint + 0.001f * worldNormal,
-                glm::reflect(reflectedRayInWorld.direction, worldNormal));
-        myIllumination +=
-            material.cReflective * ks *
-            traceRay(reflectedRay, scene, cameraPos, CTMs, inverseCTMs,
-                     transInverses, lights, primitives, ka, kd, ks, depth - 1);
+      visible++;
+      pointLight.pos = glm::vec4(position, 1);
+      pointLight.color = weight * light.color;
+      calcPhong(worldNormal, directionToCamera, point, material, pointLight, ka,
+                kd, ks, sum, textureColor, material.blend);
+    }
+    // Where the samples agree on visibility the point is fully lit or fully
+    // shadowed; only the penumbra needs more
+    if (visible == 0 || visible == taken ||
+        total * 4 > m_config.maxAreaLightSamples) {
+      break;
+    }
+  }
+  illumination += sum / static_cast<float>(taken);
+}
+
+// Intersects the neighbouring pixels' rays with the plane tangent to the
+// surface at point, giving the world-space offsets to the surface points they
+// see. Returns false if either differential ray runs parallel to the plane.
+static bool computeFootprint(const Ray &ray, glm::vec3 point, glm::vec3 normal,
+                             glm::vec3 &dpdx, glm::vec3 &dpdy) {
+  glm::vec3 originX = ray.origin + ray.dOdx;
+  glm::vec3 originY = ray.origin + ray.dOdy;
+  glm::vec3 directionX = ray.direction + ray.dDdx;
+  glm::vec3 directionY = ray.direction + ray.dDdy;
+  float denominatorX = glm::dot(normal, directionX);
+  float denominatorY = glm::dot(normal, directionY);
+  if (std::abs(denominatorX) < 1e-8f || std::abs(denominatorY) < 1e-8f) {
+    return false;
+  }
+  float planeOffset = glm::dot(normal, point);
+  float tx = (planeOffset - glm::dot(normal, originX)) / denominatorX;
+  float ty = (planeOffset - glm::dot(normal, originY)) / denominatorY;
+  dpdx = originX + tx * directionX - point;
+  dpdy = originY + ty * directionY - point;
+  return true;
+}
+
+bool RayTracer::intersect(const Ray &ray, const RayTraceScene &scene,
+                          Intersection &hit) const {
+  const std::vector<Primitive *> &primitives = scene.getPrimitives();
+  const std::vector<glm::mat4> &inverseCTMs = scene.getInverseCTMs();
+  hit.t = INFINITY;
+  hit.primitive = -1;
+  // Ties go to the first primitive, in whatever order they're tested
+  auto test = [&](int p) {
+    Ray objectRay(inverseCTMs[p] * glm::vec4(ray.origin, 1),
+                  inverseCTMs[p] * glm::vec4(ray.direction, 0));
+    float t = primitives[p]->intersect(objectRay);
+    if (t > 0 && (t < hit.t || (t == hit.t && p < hit.primitive))) {
+      hit.t = t;
+      hit.primitive = p;
+      hit.objectPoint = objectRay.origin + t * objectRay.direction;
+    }
+    return false;
+  };
+  if (m_config.enableAcceleration) {
+    scene.getBVH().traverse(ray, hit.t, test);
+  } else {
+    for (int p = 0; p < primitives.size(); p++) {
+      test(p);
+    }
+  }
+  return hit.primitive != -1;
+}
+
+// The primitive that last blocked a shadow ray towards each light, and how
+// often it blocked the next one, on the current thread. Neighbouring shadow
+// rays to a light are mostly blocked by the same primitive, and a stale entry
+// only costs one intersection test.
+struct OccluderCache {
+  std::vector<int> occluders;
+  std::uint64_t hits = 0;
+  std::uint64_t misses = 0;
+};
+
+static thread_local OccluderCache occluderCache;
+
+bool RayTracer::isOccluded(const Ray &ray, const RayTraceScene &scene,
+                           float maxT, int light) const {
+  const std::vector<Primitive *> &primitives = scene.getPrimitives();
+  const std::vector<glm::mat4> &inverseCTMs = scene.getInverseCTMs();
+  auto blocks = [&](int p) {
+    Ray objectRay(inverseCTMs[p] * glm::vec4(ray.origin, 1),
+                  inverseCTMs[p] * glm::vec4(ray.direction, 0));
+    float t = primitives[p]->intersect(objectRay);
+    return t > 0 && t < maxT;
+  };
+
+  int cached = -1;
+  if (light >= 0) {
+    std::vector<int> &occluders = occluderCache.occluders;
+    if (light >= occluders.size()) {
+      occluders.resize(light + 1, -1);
+    }
+    cached = occluders[light];
+    // The cache outlives scenes, so its entries may not be in this one
+    if (cached >= 0 && cached < primitives.size() && blocks(cached)) {
+      occluderCache.hits++;
+      return true;
+    }
+    occluderCache.misses++;
+  }
+  int occluder = -1;
+  auto test = [&](int p) {
+    if (p != cached && blocks(p)) {
+      occluder = p;
+    }
+    return occluder >= 0;
+  };
+  if (m_config.enableAcceleration) {
+    scene.getBVH().traverse(ray, maxT, test);
+  } else {
+    for (int p = 0; p < primitives.size(); p++) {
+      if (test(p)) {
+        break;
       }
     }
   }
-  return myIllumination;
+  if (occluder >= 0 && light >= 0) {
+    occluderCache.occluders[light] = occluder;
+  }
+  return occluder >= 0;
 }
 
-void RayTracer::render(RGBA *imageData, const RayTraceScene &scene) {
-#pragma omp parallel
-  Camera camera = scene.getCamera();
-  glm::mat4 inverseViewMatrix = glm::inverse(camera.getViewMatrix());
-  std::vector<glm::mat4> CTMs;
-  std::vector<glm::mat4> inverseCTMs;
-  std::vector<glm::mat3> transInverses;
-  std::vector<SceneLightData> lights = scene.getLights();
-  std::vector<Primitive *> primitives = scene.getPrimitives();
-  SceneGlobalData globalData = scene.getGlobalData();
-  int width = scene.width();
-  int height = scene.height();
+void RayTracer::flushStats() const {
+  TiledTexture::flushStats();
+  m_occluderCacheHits += occluderCache.hits;
+  m_occluderCacheMisses += occluderCache.misses;
+  occluderCache.hits = 0;
+  occluderCache.misses = 0;
+}
+
+RayTracer::Stats RayTracer::stats() const {
+  return Stats{m_occluderCacheHits, m_occluderCacheMisses};
+}
+
+glm::vec4 RayTracer::traceRay(const Ray &ray, const RayTraceScene &scene,
+                              int depth, const PixelSample &pixel,
+                              glm::vec3 throughput) {
+  if (depth == 0) {
+    return glm::vec4(0, 0, 0, 0);
+  }
+  Intersection hit;
+  if (!intersect(ray, scene, hit)) {
+    return glm::vec4(0, 0, 0, 0);
+  }
+  return shade(ray, hit, scene, depth, pixel, throughput);
+}
+
+float RayTracer::continuation(glm::vec3 throughput, float u) const {
+  float largest = std::max({throughput.r, throughput.g, throughput.b});
+  if (largest <= 0) {
+    return 0;
+  }
+  if (m_config.enableRussianRoulette &&
+      largest < m_config.rouletteThroughput) {
+    float survival = largest / m_config.rouletteThroughput;
+    return u < survival ? 1 / survival : 0;
+  }
+  return largest < m_config.minThroughput ? 0 : 1;
+}
+
+glm::vec4 RayTracer::shade(const Ray &ray, const Intersection &hit,
+                           const RayTraceScene &scene, int depth,
+                           const PixelSample &pixel, glm::vec3 throughput,
+                           glm::vec3 *albedo) {
+  Primitive *primitive = scene.getPrimitives()[hit.primitive];
+  const glm::mat4 &inverseCTM = scene.getInverseCTMs()[hit.primitive];
+  const SceneGlobalData &globalData = scene.getGlobalData();
   float ka = globalData.ka;
   float kd = globalData.kd;
   float ks = globalData.ks;
-  for (int i = 0; i < primitives.size(); i++) {
-    glm::mat4 ctm = primitives[i]->getCTM();
-    glm::mat4 inverseCTM = glm::inverse(ctm);
-    CTMs.push_back(ctm);
-    inverseCTMs.push_back(inverseCTM);
-    transInverses.push_back(glm::transpose(inverseCTM));
+
+  SceneMaterial material = primitive->getMaterial();
+  glm::vec3 objectPoint = hit.objectPoint;
+  glm::vec3 normal = primitive->getNormal(objectPoint);
+  glm::vec3 worldNormal =
+      glm::normalize(scene.getNormalMatrices()[hit.primitive] * normal);
+  glm::vec3 worldIntersectionPoint = ray.origin + hit.t * ray.direction;
+  glm::vec3 directionToCamera = -glm::normalize(ray.direction);
+
+  // Footprint of the neighbouring pixels on the surface, for texture filtering
+  glm::vec3 dpdx(0, 0, 0);
+  glm::vec3 dpdy(0, 0, 0);
+  bool hasFootprint =
+      ray.hasDifferentials && computeFootprint(ray, worldIntersectionPoint,
+                                               worldNormal, dpdx, dpdy);
+  if (!hasFootprint) {
+    dpdx = dpdy = glm::vec3(0, 0, 0);
+  }
+
+  glm::vec4 illumination = glm::vec4(0, 0, 0, 0);
+  illumination += material.cAmbient * ka;
+  // The texture lookup doesn't depend on the light, so sample it once
+  glm::vec4 textureColor(0, 0, 0, 0);
+  if (m_config.enableTextureFilter && hasFootprint) {
+    textureColor = primitive->getTextureColor(
+        objectPoint, inverseCTM * glm::vec4(dpdx, 0),
+        inverseCTM * glm::vec4(dpdy, 0));
+  } else {
+    textureColor = primitive->getTextureColor(objectPoint, glm::vec3(0, 0, 0),
+                                              glm::vec3(0, 0, 0));
+  }
+  if (albedo) {
+    // The diffuse color as calcPhong blends it
+    *albedo = glm::vec3(material.blend * 2.0f * textureColor +
+                        material.cDiffuse * (1 - material.blend));
+  }
+
+  // Adds one light's contribution; lightPixel places its shadow rays
+  const std::vector<SceneLightData> &lights = scene.getLights();
+  auto addLight = [&](int l, const SceneLightData &light,
+                      const PixelSample &lightPixel) {
+    if (light.type == LightType::LIGHT_AREA) {
+      // Each light and bounce draws from its own dimension of the sampler
+      addAreaLight(light, worldNormal, directionToCamera,
+                   worldIntersectionPoint, material, ka, kd, ks, illumination,
+                   textureColor, scene, lightPixel, l,
+                   Sampler::LIGHT + 16 * l + depth);
+      return;
+    }
+    glm::vec3 shadowRayDirection = glm::vec3(0, 0, 0);
+    // A point or spot light is only blocked by what lies between it and the
+    // point; a surface on the far side of the light can't shadow it. Shadow
+    // rays toward them stop at the light, while directional lights, being
+    // infinitely far away, are blocked by anything along the ray.
+    float maxT = INFINITY;
+    if (light.type == LightType::LIGHT_POINT ||
+        light.type == LightType::LIGHT_SPOT) {
+      shadowRayDirection =
+          glm::normalize(glm::vec3(light.pos) - worldIntersectionPoint);
+      maxT = glm::distance(glm::vec3(light.pos), worldIntersectionPoint);
+    } else {
+      shadowRayDirection = -glm::normalize(glm::vec3(light.dir));
+    }
+    Ray shadowRay = Ray(worldIntersectionPoint + 0.001f * shadowRayDirection,
+                        shadowRayDirection);
+    if (!isOccluded(shadowRay, scene, maxT, l)) {
+      calcPhong(worldNormal, directionToCamera, worldIntersectionPoint,
+                material, light, ka, kd, ks, illumination, textureColor,
+                material.blend);
+    }
+  };
+
+  const LightTree &lightTree = scene.getLightTree();
+  int budget = std::max(m_config.lightSamples, 1);
+  if (m_config.enableLightSampling && lightTree.size() > budget) {
+    // Shade a few lights picked by their estimated contribution, each
+    // divided by its chance of being picked
+    for (int l : lightTree.unsampled()) {
+      addLight(l, lights[l], pixel);
+    }
+    std::uint32_t stride =
+        std::bit_ceil(static_cast<std::uint32_t>(budget));
+    for (int k = 0; k < budget; k++) {
+      PixelSample lightPixel{pixel.x, pixel.y, pixel.index * stride + k};
+      float u = m_sampler
+                    .get2D(pixel.x, pixel.y, lightPixel.index,
+                           Sampler::LIGHT_SELECTION + 16 * depth)
+                    .x;
+      float probability;
+      int l = lightTree.sample(worldIntersectionPoint, worldNormal, u,
+                               probability);
+      if (l < 0) {
+        // No light in the tree reaches the point
+        break;
+      }
+      SceneLightData picked = lights[l];
+      picked.color /= budget * probability;
+      addLight(l, picked, lightPixel);
+    }
+  } else {
+    // Only lights within their cutoff radius of the point can add to it
+    scene.getLightIndex().forEachLight(
+        worldIntersectionPoint, [&](int l) { addLight(l, lights[l], pixel); });
+  }
+
+  // Secondary rays that would add too little to the pixel aren't traced;
+  // with Russian roulette they're kept at random
+  glm::vec2 roulette(0, 0);
+  if (m_config.enableRussianRoulette) {
+    roulette = m_sampler.get2D(pixel.x, pixel.y, pixel.index,
+                               Sampler::ROULETTE + 16 * depth);
+  }
+  glm::vec3 reflectedThroughput =
+      throughput * glm::vec3(material.cReflective) * ks;
+  float reflectedScale = continuation(reflectedThroughput, roulette.x);
+  glm::vec3 refractedThroughput =
+      throughput * glm::vec3(material.cTransparent) * ks;
+  float refractedScale = continuation(refractedThroughput, roulette.y);
+
+  if (depth > 1 && reflectedScale > 0) {
+    Ray reflectedRay =
+        Ray(worldIntersectionPoint + 0.001f * worldNormal,
+            glm::reflect(ray.direction, worldNormal));
+    if (hasFootprint) {
+      // Treat the surface as locally flat: the reflected differentials
+      // start from the footprint and mirror the incoming directions
+      reflectedRay.hasDifferentials = true;
+      reflectedRay.dOdx = dpdx;
+      reflectedRay.dOdy = dpdy;
+      reflectedRay.dDdx = glm::reflect(ray.dDdx, worldNormal);
+      reflectedRay.dDdy = glm::reflect(ray.dDdy, worldNormal);
+    }
+    illumination += reflectedScale * material.cReflective * ks *
+                    traceRay(reflectedRay, scene, depth - 1, pixel,
+                             reflectedScale * reflectedThroughput);
+  }
+
+  if (depth > 1 && refractedScale > 0) {
+    float n1 = 1;
+    float n2 = material.ior;
+    float n = n1 / n2;
+    glm::vec3 incident = -directionToCamera;
+    float cosTheta1 = glm::dot(incident, worldNormal);
+    float cosTheta2 = sqrt(1 - n * n * (1 - cosTheta1 * cosTheta1));
+    glm::vec3 refractedDirection =
+        n * incident + (n * cosTheta1 - cosTheta2) * worldNormal;
+    Ray refractedRay =
+        Ray(worldIntersectionPoint + .001f * refractedDirection,
+            refractedDirection);
+    if (hasFootprint) {
+      // Differentiate the refraction above with respect to the normalized
+      // incident direction, again treating the surface as locally flat
+      float length = glm::length(ray.direction);
+      glm::vec3 dIdx =
+          (ray.dDdx - glm::dot(incident, ray.dDdx) * incident) / length;
+      glm::vec3 dIdy =
+          (ray.dDdy - glm::dot(incident, ray.dDdy) * incident) / length;
+      float dCosdx = glm::dot(dIdx, worldNormal);
+      float dCosdy = glm::dot(dIdy, worldNormal);
+      float cosTerm = n * n * cosTheta1 / cosTheta2;
+      refractedRay.hasDifferentials = true;
+      refractedRay.dOdx = dpdx;
+      refractedRay.dOdy = dpdy;
+      refractedRay.dDdx = n * dIdx + (n - cosTerm) * dCosdx * worldNormal;
+      refractedRay.dDdy = n * dIdy + (n - cosTerm) * dCosdy * worldNormal;
+    }
+    illumination += refractedScale * material.cTransparent * ks *
+                    traceRay(refractedRay, scene, depth - 1, pixel,
+                             refractedScale * refractedThroughput);
+  }
+  return illumination;
+}
+
+RayTracer::Sample RayTracer::traceSample(const Ray &ray,
+                                         const RayTraceScene &scene,
+                                         const PixelSample &pixel) {
+  Sample sample{glm::vec4(0, 0, 0, 0), -1, glm::vec3(0, 0, 0), INFINITY,
+                glm::vec3(0, 0, 0)};
+  Intersection hit;
+  if (!intersect(ray, scene, hit)) {
+    return sample;
+  }
+  Primitive *primitive = scene.getPrimitives()[hit.primitive];
+  sample.primitive = hit.primitive;
+  sample.depth = hit.t;
+  sample.normal = glm::normalize(scene.getNormalMatrices()[hit.primitive] *
+                                 primitive->getNormal(hit.objectPoint));
+  // The primary hit plus the reflected or refracted bounces
+  sample.color = shade(ray, hit, scene, m_config.maxBounces + 1, pixel,
+                       glm::vec3(1, 1, 1), &sample.albedo);
+  return sample;
+}
+
+bool RayTracer::differs(const Sample &a, const Sample &b) const {
+  if (a.primitive != b.primitive) {
+    return true;
+  }
+  // Creases within one primitive, like a cube's edges (about 25 degrees)
+  if (a.primitive != -1 && glm::dot(a.normal, b.normal) < 0.9f) {
+    return true;
+  }
+  // Compare what will be displayed, so that differences above white are
+  // ignored
+  glm::vec3 contrast =
+      glm::abs(glm::clamp(glm::vec3(a.color), 0.0f, 1.0f) -
+               glm::clamp(glm::vec3(b.color), 0.0f, 1.0f));
+  return std::max(contrast.r, std::max(contrast.g, contrast.b)) >
+         m_config.superSampleContrast;
+}
+
+// Builds camera rays through points on the image plane, given in pixels from
+// the top-left corner of the image.
+struct CameraRays {
+  glm::mat4 inverseViewMatrix;
+  glm::vec3 origin;
+  float viewPlaneWidth;
+  float viewPlaneHeight;
+  int width;
+  int height;
+  // Moving one pixel right or down shifts the ray direction by a constant
+  glm::vec3 dDdx;
+  glm::vec3 dDdy;
+
+  // The thin lens: its radius, and the distance to the plane in focus
+  float lensRadius;
+  float focalLength;
+
+  // spacing is the distance in pixels to the neighbouring samples, which
+  // scales the ray differentials. lens is a point on the unit disk; away from
+  // its centre the ray starts off the pinhole and bends through the point on
+  // the focal plane that the pinhole ray would hit.
+  Ray generate(float px, float py, float spacing,
+               glm::vec2 lens = glm::vec2(0, 0)) const {
+    float x = px / width - 0.5f;
+    float y = 0.5f - py / height;
+    glm::vec3 direction(x * viewPlaneWidth, y * viewPlaneHeight, -1);
+    Ray ray;
+    ray.hasDifferentials = true;
+    ray.dOdx = ray.dOdy = glm::vec3(0, 0, 0);
+    if (lens == glm::vec2(0, 0) || lensRadius == 0) {
+      ray.origin = origin;
+      ray.direction = glm::vec3(inverseViewMatrix * glm::vec4(direction, 0));
+      ray.dDdx = spacing * dDdx;
+      ray.dDdy = spacing * dDdy;
+      return ray;
+    }
+    // The direction keeps unit depth, so the ray parameter is still the
+    // depth, and reaches the focal plane at the pinhole ray's point; the
+    // neighbouring rays meet it there too
+    glm::vec3 lensPoint(lensRadius * lens, 0);
+    ray.origin = glm::vec3(inverseViewMatrix * glm::vec4(lensPoint, 1));
+    ray.direction = glm::vec3(
+        inverseViewMatrix * glm::vec4(direction - lensPoint / focalLength, 0));
+    ray.dDdx = spacing * dDdx;
+    ray.dDdy = spacing * dDdy;
+    return ray;
   }
+
+  // Returns the diameter in pixels of the blur circle that the lens gives a
+  // point at the given depth along the view axis.
+  float circleOfConfusion(float depth) const {
+    float blur = 2 * lensRadius * std::abs(1 / focalLength - 1 / depth);
+    return blur * width / viewPlaneWidth;
+  }
+};
+
+// Sets up camera rays for the scene's camera, with its lens if depthOfField is
+// set and as a pinhole camera otherwise.
+static CameraRays cameraRaysFor(const RayTraceScene &scene, bool depthOfField) {
+  Camera camera = scene.getCamera();
+  CameraRays cameraRays;
+  cameraRays.inverseViewMatrix = glm::inverse(camera.getViewMatrix());
+  cameraRays.width = scene.width();
+  cameraRays.height = scene.height();
+  cameraRays.viewPlaneWidth = 2 * tan(camera.getWidthAngle() / 2);
+  cameraRays.viewPlaneHeight = 2 * tan(camera.getHeightAngle() / 2);
+  cameraRays.lensRadius = depthOfField ? camera.getAperture() / 2 : 0;
+  cameraRays.focalLength = camera.getFocalLength();
+  cameraRays.origin =
+      glm::vec3(cameraRays.inverseViewMatrix * glm::vec4(0, 0, 0, 1));
+  cameraRays.dDdx =
+      glm::vec3(cameraRays.inverseViewMatrix *
+                glm::vec4(cameraRays.viewPlaneWidth / scene.width(), 0, 0, 0));
+  cameraRays.dDdy = glm::vec3(
+      cameraRays.inverseViewMatrix *
+      glm::vec4(0, -cameraRays.viewPlaneHeight / scene.height(), 0, 0));
+  return cameraRays;
+}
+
+// Blur from a foreground object also covers its neighbours, so each pixel
+// passes its lens sample count on to every pixel within its blur circle, up
+// to this many pixels away; the limit keeps strongly blurred frames cheap to
+// scan
+static constexpr int MAX_BLUR_SPREAD = 16;
+
+// Returns how many lens samples each pixel needs, from the blur circles of the
+// depths seen through the centres of a width x height block of pixels. Pixels
+// in focus need only one.
+static std::vector<int>
+lensSampleCounts(const CameraRays &cameraRays,
+                 const std::vector<RayTracer::Sample> &centres, int width,
+                 int height, float samplesPerPixel, int maxSamples) {
+  std::vector<int> counts(width * height, 1);
   for (int j = 0; j < height; j++) {
     for (int i = 0; i < width; i++) {
-      float x = (i + 0.5) / width - 0.5;
-      float y = (height - 1 - j + 0.5) / height - 0.5;
-      float heightAngle = camera.getHeightAngle();
-      float widthAngle = camera.getWidthAngle();
-      float k = 1;
-      glm::vec3 worldIntersectionPoint;
-      glm::vec3 origin = glm::vec3(inverseViewMatrix * glm::vec4(0, 0, 0, 1));
-      glm::vec3 direction = glm::vec3(
-          inverseViewMatrix * glm::vec4(2 * x * tan(widthAngle / 2),
-                                        2 * y * tan(heightAngle / 2), -k, 0));
-      float smallestT = INFINITY;
-      for (int p = 0; p < primitives.size(); p++) {
-        Primitive *primitive = primitives[p];
-        Ray ray(inverseCTMs[p] * glm::vec4(origin, 1),
-                inverseCTMs[p] * glm::vec4(direction, 0));
-        float t = primitive->intersect(ray);
-        if (t > 0 && t < smallestT) {
-          smallestT = t;
-          SceneMaterial material = primitive->getMaterial();
-          glm::vec3 objectPoint = inverseCTMs[p] * glm::vec4(origin, 1) +
-                                  t * inverseCTMs[p] * glm::vec4(direction, 0);
-          glm::vec3 normal = primitive->getNormal(objectPoint);
-          glm::mat3 invTrans = transInverses[p];
-          glm::vec3 worldNormal = glm::normalize(invTrans * normal);
-          glm::vec3 directionToCamera = glm::normalize(-direction);
-          glm::vec4 illumination = glm::vec4(0, 0, 0, 0);
-          illumination += material.cAmbient * ka;
-          for (int l = 0; l < lights.size(); l++) {
-            SceneLightData light = lights[l];
-            worldIntersectionPoint = CTMs[p] * glm::vec4(objectPoint, 1);
-            glm::vec3 shadowRayDirection = glm::vec3(0, 0, 0);
-            if (light.type == LightType::LIGHT_POINT ||
-                light.type == LightType::LIGHT_SPOT) {
-              shadowRayDirection =
-                  glm::normalize(glm::vec3(light.pos) - worldIntersectionPoint);
-            } else {
-              shadowRayDirection = -glm::normalize(glm::vec3(light.dir));
+      float radius =
+          cameraRays.circleOfConfusion(centres[j * width + i].depth) / 2;
+      if (radius < 0.5f) {
+        continue;
+      }
+      int count = static_cast<int>(std::ceil(samplesPerPixel *
+                                             float(M_PI) * radius * radius));
+      count = std::clamp(count, 1, maxSamples);
+      int spread =
+          std::min(static_cast<int>(std::ceil(radius)), MAX_BLUR_SPREAD);
+      for (int y = std::max(j - spread, 0);
+           y <= std::min(j + spread, height - 1); y++) {
+        for (int x = std::max(i - spread, 0);
+             x <= std::min(i + spread, width - 1); x++) {
+          if ((x - i) * (x - i) + (y - j) * (y - j) <= spread * spread) {
+            counts[y * width + x] = std::max(counts[y * width + x], count);
+          }
+        }
+      }
+    }
+  }
+  return counts;
+}
+
+void RayTracer::forEachRow(int height,
+                           const std::function<void(int)> &renderRow,
+                           bool parallel) const {
+  if (!parallel) {
+    for (int j = 0; j < height; j++) {
+      renderRow(j);
+    }
+    flushStats();
+    return;
+  }
+  // Each row only writes its own pixels, and every sample is a function of
+  // its pixel alone, so the image doesn't depend on how rows are scheduled
+  std::vector<int> rows(height);
+  for (int j = 0; j < height; j++) {
+    rows[j] = j;
+  }
+  QtConcurrent::blockingMap(rows, [&](int j) {
+    renderRow(j);
+    flushStats();
+  });
+}
+
+// Averages the camera samples of one pixel, along with their guides
+struct PixelAverage {
+  glm::vec4 color{0, 0, 0, 0};
+  glm::vec3 normal{0, 0, 0};
+  glm::vec3 albedo{0, 0, 0};
+  float depth = 0;
+  int count = 0;
+  int hits = 0;
+
+  void add(const RayTracer::Sample &sample) {
+    color += sample.color;
+    count++;
+    if (sample.primitive != -1) {
+      normal += sample.normal;
+      albedo += sample.albedo;
+      depth += sample.depth;
+      hits++;
+    }
+  }
+
+  // Writes the average into frame, with primitive as the one the pixel shows
+  void store(FrameBuffer &frame, int x, int y, int primitive) const {
+    frame.color(x, y) = color / static_cast<float>(count);
+    if (frame.hasGuides() && hits > 0) {
+      frame.guides(x, y) = PixelGuides{glm::normalize(normal),
+                                       albedo / static_cast<float>(count),
+                                       depth / hits, primitive};
+    }
+  }
+};
+
+void RayTracer::render(RGBA *imageData, const RayTraceScene &scene) {
+  FrameBuffer frame(scene.width(), scene.height(), m_config.enableDenoise);
+  render(frame, scene);
+  resolve(frame, imageData);
+}
+
+void RayTracer::render(FrameBuffer &frame, const RayTraceScene &scene) {
+  renderRegion(frame, scene, glm::ivec2(0, 0), m_config.enableParallelism);
+  denoise(frame);
+}
+
+void RayTracer::renderRegion(FrameBuffer &frame, const RayTraceScene &scene,
+                             glm::ivec2 origin, bool parallel) {
+  if (m_config.enableProgressive) {
+    AccumulationBuffer buffer(frame.width(), frame.height(),
+                              frame.hasGuides());
+    renderPasses(buffer, scene, origin, parallel, {});
+    buffer.resolve(frame);
+  } else {
+    renderSamples(frame, scene, origin, parallel);
+  }
+}
+
+void RayTracer::renderTiles(
+    const RayTraceScene &scene, int tileSize,
+    const std::function<void(glm::ivec2, glm::ivec2, const RGBA *)> &onTile) {
+  // The denoiser draws on the pixels around each one, so denoised regions are
+  // rendered with that much margin and then cropped. Rendering a region b
+  // pixels across traces (1 + 2 * margin / b)^2 times its rays, so tiles are
+  // grouped into blocks at least BLOCK_MARGINS margins across.
+  constexpr int BLOCK_MARGINS = 8;
+  Denoiser::Settings denoiserSettings = m_config.denoiser;
+  denoiserSettings.parallel = false;
+  Denoiser denoiser(denoiserSettings);
+  int margin = m_config.enableDenoise ? denoiser.reach() : 0;
+  int blockTiles = (BLOCK_MARGINS * margin + tileSize - 1) / tileSize;
+  int blockSize = tileSize * std::max(blockTiles, 1);
+  ToneMapper::Settings toneMapperSettings = m_config.toneMapper;
+  toneMapperSettings.parallel = false;
+  ToneMapper toneMapper(toneMapperSettings);
+
+  glm::ivec2 imageSize(scene.width(), scene.height());
+  std::vector<glm::ivec2> blocks;
+  for (int y = 0; y < imageSize.y; y += blockSize) {
+    for (int x = 0; x < imageSize.x; x += blockSize) {
+      blocks.push_back(glm::ivec2(x, y));
+    }
+  }
+
+  // Each block is rendered on a single thread, and the pool works on several
+  // blocks at once
+  auto renderBlock = [&](const glm::ivec2 &block) {
+    glm::ivec2 size = glm::min(glm::ivec2(blockSize), imageSize - block);
+    glm::ivec2 begin = glm::max(block - margin, glm::ivec2(0));
+    glm::ivec2 end = glm::min(block + size + margin, imageSize);
+    FrameBuffer frame(end.x - begin.x, end.y - begin.y,
+                      m_config.enableDenoise);
+    renderRegion(frame, scene, begin, false);
+    if (m_config.enableDenoise) {
+      denoiser.denoise(frame);
+    }
+
+    std::vector<RGBA> pixels(tileSize * tileSize);
+    for (int y = block.y; y < block.y + size.y; y += tileSize) {
+      for (int x = block.x; x < block.x + size.x; x += tileSize) {
+        glm::ivec2 tile(x, y);
+        glm::ivec2 extent = glm::min(glm::ivec2(tileSize), imageSize - tile);
+        glm::ivec2 first = tile - begin;
+        glm::ivec2 last = first + extent;
+        toneMapper.resolve(frame, pixels.data(), extent.x, first.x, first.y,
+                           last.x, last.y, begin);
+        onTile(tile, extent, pixels.data());
+      }
+    }
+  };
+  if (m_config.enableParallelism) {
+    QtConcurrent::blockingMap(blocks, renderBlock);
+  } else {
+    std::for_each(blocks.begin(), blocks.end(), renderBlock);
+  }
+}
+
+void RayTracer::denoise(FrameBuffer &frame) const {
+  if (!m_config.enableDenoise) {
+    return;
+  }
+  Denoiser::Settings settings = m_config.denoiser;
+  settings.parallel = m_config.enableParallelism;
+  Denoiser(settings).denoise(frame);
+}
+
+void RayTracer::resolve(const FrameBuffer &frame, RGBA *imageData) const {
+  ToneMapper::Settings settings = m_config.toneMapper;
+  settings.parallel = m_config.enableParallelism;
+  ToneMapper(settings).resolve(frame, imageData);
+}
+
+void RayTracer::renderSamples(FrameBuffer &frame, const RayTraceScene &scene,
+                              glm::ivec2 origin, bool parallel) {
+  CameraRays cameraRays = cameraRaysFor(scene, m_config.enableDepthOfField);
+  int width = frame.width();
+  int height = frame.height();
+  bool depthOfField = cameraRays.lensRadius > 0;
+
+  if (!m_config.enableSuperSample && !depthOfField) {
+    forEachRow(
+        height,
+        [&](int y) {
+          int j = origin.y + y;
+          for (int x = 0; x < width; x++) {
+            int i = origin.x + x;
+            Ray ray = cameraRays.generate(i + 0.5f, j + 0.5f, 1);
+            Sample sample = traceSample(ray, scene, {i, j, 0});
+            PixelAverage average;
+            average.add(sample);
+            average.store(frame, x, y, sample.primitive);
+          }
+        },
+        parallel);
+    return;
+  }
+
+  // A first pass of pinhole rays through the pixel centres finds the pixels
+  // that differ from a neighbour, which lie on edges, silhouettes or texture
+  // detail, and the depths that decide how blurred each pixel is. When frame
+  // is part of the image, the pass also covers the pixels around it that
+  // those decisions depend on.
+  int margin = depthOfField ? MAX_BLUR_SPREAD : 1;
+  glm::ivec2 begin = glm::max(origin - margin, glm::ivec2(0));
+  glm::ivec2 end = glm::min(origin + glm::ivec2(width, height) + margin,
+                            glm::ivec2(scene.width(), scene.height()));
+  int passWidth = end.x - begin.x;
+  int passHeight = end.y - begin.y;
+  std::vector<Sample> centres(passWidth * passHeight);
+  forEachRow(
+      passHeight,
+      [&](int y) {
+        int j = begin.y + y;
+        for (int x = 0; x < passWidth; x++) {
+          int i = begin.x + x;
+          centres[y * passWidth + x] =
+              traceSample(cameraRays.generate(i + 0.5f, j + 0.5f, 1), scene,
+                          {i, j, 0});
+        }
+      },
+      parallel);
+  std::vector<char> refine(passWidth * passHeight, false);
+  if (m_config.enableSuperSample) {
+    for (int y = 0; y < passHeight; y++) {
+      for (int x = 0; x < passWidth; x++) {
+        int index = y * passWidth + x;
+        if (x + 1 < passWidth && differs(centres[index], centres[index + 1])) {
+          refine[index] = refine[index + 1] = true;
+        }
+        if (y + 1 < passHeight &&
+            differs(centres[index], centres[index + passWidth])) {
+          refine[index] = refine[index + passWidth] = true;
+        }
+      }
+    }
+  }
+  std::vector<int> lensSamples;
+  if (depthOfField) {
+    lensSamples = lensSampleCounts(cameraRays, centres, passWidth, passHeight,
+                                   m_config.lensSamplesPerPixel,
+                                   m_config.maxLensSamples);
+  }
+
+  forEachRow(
+      height,
+      [&](int y) {
+        int j = origin.y + y;
+        for (int x = 0; x < width; x++) {
+          int i = origin.x + x;
+          int index = (j - begin.y) * passWidth + (i - begin.x);
+          const Sample &centre = centres[index];
+          PixelAverage average;
+          if (depthOfField && lensSamples[index] > 1) {
+            // Blurred pixels spread their samples over both the pixel and
+            // the lens; the pinhole centre sample isn't part of that average
+            for (int k = 0; k < lensSamples[index]; k++) {
+              glm::vec2 offset = m_sampler.get2D(i, j, k, Sampler::PIXEL);
+              glm::vec2 lens = Sampler::squareToDisk(
+                  m_sampler.get2D(i, j, k, Sampler::LENS));
+              Ray ray =
+                  cameraRays.generate(i + offset.x, j + offset.y, 1, lens);
+              average.add(traceSample(ray, scene,
+                                      {i, j, static_cast<std::uint32_t>(k)}));
             }
-            Ray shadowRay =
-                Ray(worldIntersectionPoint + 0.001f * shadowRayDirection,
-                    shadowRayDirection);
-            bool obstructed = false;
-            for (int p = 0; p < primitives.size(); p++) {
-              Primitive *primitive = primitives[p];
-              Ray shadowRayObject =
-                  Ray(inverseCTMs[p] * glm::vec4(shadowRay.origin, 1),
-                      inverseCTMs[p] * glm::vec4(shadowRay.direction, 0));
-              float t = primitive->intersect(shadowRayObject);
-              if (t > 0) {
-                obstructed = true;
-                break;
+          } else {
+            average.add(centre);
+            if (refine[index]) {
+              // Refined pixels get 4 samples, then 16, 64 and so on for as
+              // long as the new samples still disagree with the centre. Each
+              // power-of-four prefix of the sampler's points is stratified
+              // over the pixel.
+              int taken = 0;
+              for (int total = 4, side = 2;
+                   total <= m_config.maxSuperSamples; total *= 4, side *= 2) {
+                bool disagree = false;
+                for (; taken < total; taken++) {
+                  glm::vec2 offset =
+                      m_sampler.get2D(i, j, taken, Sampler::PIXEL);
+                  Ray ray = cameraRays.generate(i + offset.x, j + offset.y,
+                                                1.0f / side);
+                  Sample sample = traceSample(
+                      ray, scene,
+                      {i, j, static_cast<std::uint32_t>(taken + 1)});
+                  average.add(sample);
+                  disagree = disagree || differs(sample, centre);
+                }
+                if (!disagree) {
+                  break;
+                }
               }
             }
-            if (!obstructed) {
-              RGBA curColor = primitive->getTextureColor(objectPoint);
-              float blend = material.blend;
-              calcPhong(worldNormal, directionToCamera, worldIntersectionPoint,
-                        material, light, ka, kd, ks, illumination, curColor,
-                        blend);
-            }
           }
-          if (material.cReflective != glm::vec4(0, 0, 0, 0)) {
-            Ray incidentRay = Ray(worldIntersectionPoint, -directionToCamera);
-            Ray reflectedRay =
-                Ray(worldIntersectionPoint,
-                    glm::reflect(incidentRay.direction, worldNormal));
-            illumination +=
-                material.cReflective * ks *
-                traceRay(reflectedRay, scene, origin, CTMs, inverseCTMs,
-                         transInverses, lights, primitives, ka, kd, ks, 4);
-          }
-          if (material.cTransparent != glm::vec4(0, 0, 0, 0)) {
-            float n1 = 1;
-            float n2 = material.ior;
-            float n = n1 / n2;
-            Ray incidentRay = Ray(worldIntersectionPoint, -directionToCamera);
-            glm::vec3 normal = worldNormal;
-            float cosTheta1 = glm::dot(incidentRay.direction, normal);
-            float cosTheta2 = sqrt(1 - n * n * (1 - cosTheta1 * cosTheta1));
-            glm::vec3 refractedDirection = n * incidentRay.direction +
-                                           (n * cosTheta1 - cosTheta2) * normal;
-            Ray refractedRay =
-                Ray(worldIntersectionPoint + .001f * refractedDirection,
-                    refractedDirection);
-            illumination +=
-                material.cTransparent * ks *
-                traceRay(refractedRay, scene, origin, CTMs, inverseCTMs,
-                         transInverses, lights, primitives, ka, kd, ks, 4);
-          }
-          imageData[j * width + i] = toRGBA(illumination);
+          average.store(frame, x, y, centre.primitive);
         }
-      }
+      },
+      parallel);
+}
+
+bool RayTracer::isConverged(const AccumulationBuffer &buffer, int x,
+                            int y) const {
+  int count = buffer.sampleCount(x, y);
+  if (count < m_config.progressiveMinSamples) {
+    return false;
+  }
+  return count >= m_config.progressiveMaxSamples ||
+         buffer.standardError(x, y) <= m_config.progressiveError;
+}
+
+void RayTracer::renderProgressive(
+    AccumulationBuffer &buffer, const RayTraceScene &scene,
+    const std::function<void(int, int)> &onPass) {
+  renderPasses(buffer, scene, glm::ivec2(0, 0), m_config.enableParallelism,
+               onPass);
+}
+
+void RayTracer::renderPasses(AccumulationBuffer &buffer,
+                             const RayTraceScene &scene, glm::ivec2 origin,
+                             bool parallel,
+                             const std::function<void(int, int)> &onPass) {
+  CameraRays cameraRays = cameraRaysFor(scene, m_config.enableDepthOfField);
+  int width = buffer.width();
+  int height = buffer.height();
+  // Pixels converge on their own, so a region renders just as it would as
+  // part of the whole image
+  for (int pass = 0;; pass++) {
+    std::atomic<int> active = 0;
+    forEachRow(
+        height,
+        [&](int y) {
+          int j = origin.y + y;
+          for (int x = 0; x < width; x++) {
+            if (isConverged(buffer, x, y)) {
+              continue;
+            }
+            active++;
+            int i = origin.x + x;
+            // The first pass goes through the pixel centres, so it looks
+            // like a plain render; later ones spread over the pixel
+            glm::vec2 offset(0.5f, 0.5f);
+            if (pass > 0) {
+              offset = m_sampler.get2D(i, j, pass - 1, Sampler::PIXEL);
+            }
+            glm::vec2 lens(0, 0);
+            if (cameraRays.lensRadius > 0) {
+              lens = Sampler::squareToDisk(
+                  m_sampler.get2D(i, j, pass, Sampler::LENS));
+            }
+            Ray ray = cameraRays.generate(i + offset.x, j + offset.y, 1, lens);
+            Sample sample = traceSample(
+                ray, scene, {i, j, static_cast<std::uint32_t>(pass)});
+            buffer.add(x, y, sample.color,
+                       PixelGuides{sample.normal, sample.albedo, sample.depth,
+                                   sample.primitive});
+          }
+        },
+        parallel);
+    if (active == 0) {
+      return;
+    }
+    if (onPass) {
+      onPass(pass, active);
     }
   }
 }
@@ -1,15 +1,27 @@
 #pragma once
 
+#include "accumulationbuffer.h"
+#include "denoiser/denoiser.h"
+#include "framebuffer.h"
 #include "geometry/primitive.h"
 #include "ray.hpp"
 #include "raytracescene.h"
+#include "sampler/sampler.h"
+#include "tonemapper.h"
 #include "utils/rgba.h"
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
 #include <glm/glm.hpp>
 
 // A forward declaration for the RaytraceScene class
 
 class RayTraceScene;
 
+// Clamps an illumination to [0, 1] and quantizes it to an 8-bit color
+RGBA toRGBA(const glm::vec4 &illumination);
+
 // A class representing a ray-tracer
 
 class RayTracer {
@@ -24,6 +36,64 @@ public:
     bool enableSuperSample = false;
     bool enableAcceleration = false;
     bool enableDepthOfField = false;
+
+    // Supersampling refines a pixel whose centre sample disagrees with a
+    // neighbour's, on grids of up to maxSuperSamples samples. Colours
+    // disagree when a channel differs by more than superSampleContrast.
+    int maxSuperSamples = 16;
+    float superSampleContrast = 0.1f;
+
+    // Progressive rendering adds a sample to every unconverged pixel per
+    // pass. A pixel converges once it has progressiveMinSamples and the
+    // standard error of its luminance falls to progressiveError, or once it
+    // reaches progressiveMaxSamples.
+    bool enableProgressive = false;
+    int progressiveMinSamples = 4;
+    int progressiveMaxSamples = 256;
+    float progressiveError = 0.005f;
+
+    // Depth of field sizes each blurred pixel's samples by the area of its
+    // blur circle, lensSamplesPerPixel per pixel covered, up to
+    // maxLensSamples.
+    float lensSamplesPerPixel = 1.0f;
+    int maxLensSamples = 64;
+
+    // Area lights start with areaLightSamples shadow rays per shading point,
+    // and multiply them by four while they disagree on visibility, up to
+    // maxAreaLightSamples.
+    int areaLightSamples = 4;
+    int maxAreaLightSamples = 64;
+
+    // Light sampling shades lightSamples lights per hit, picked at random in
+    // proportion to their estimated contribution, in scenes with more
+    // positioned lights than that. Directional lights are always shaded.
+    bool enableLightSampling = false;
+    int lightSamples = 8;
+
+    // Reflected and refracted rays are followed for up to maxBounces
+    // bounces, and dropped once what they add to the pixel is scaled below
+    // minThroughput. With Russian roulette, rays scaled below
+    // rouletteThroughput are instead kept at random, in proportion to their
+    // weight, and scaled up to make up for the ones dropped.
+    // Each bounce draws from its own sampler dimensions, 16 apart per light,
+    // which only stay distinct for up to MAX_BOUNCES bounces.
+    static constexpr int MAX_BOUNCES = 12;
+    int maxBounces = 4;
+    float minThroughput = 0.5f / 255;
+    bool enableRussianRoulette = false;
+    float rouletteThroughput = 0.1f;
+
+    // Denoising filters the finished frame, guided by the normals, albedo,
+    // depth and primitives that the camera rays saw
+    bool enableDenoise = false;
+    Denoiser::Settings denoiser;
+
+    // How float color is turned into 8-bit pixels
+    ToneMapper::Settings toneMapper;
+
+    // Where supersampling and progressive rendering place their samples
+    Sampler::Type samplerType = Sampler::Type::Sobol;
+    std::uint32_t samplerSeed = 0;
   };
 
 public:
@@ -34,19 +104,168 @@ public:
   // @param imageData The pointer to the imageData to be filled.
   // @param scene The scene to be rendered.
   void render(RGBA *imageData, const RayTraceScene &scene);
+
+  // Renders the scene into frame in float color, writing the denoiser's
+  // guides too if frame keeps them.
+  void render(FrameBuffer &frame, const RayTraceScene &scene);
+
+  // Runs the denoiser over frame, if it's enabled.
+  void denoise(FrameBuffer &frame) const;
+
+  // Tone-maps and quantizes frame into imageData.
+  void resolve(const FrameBuffer &frame, RGBA *imageData) const;
+
+  // Renders the scene a tile of tileSize x tileSize pixels at a time, for
+  // images too big to keep in memory. Each tile is rendered, denoised and
+  // tone-mapped, then passed to onTile with the position of its top-left
+  // pixel, its size (smaller at the right and bottom edges) and its pixels,
+  // row by row. With parallelism each thread works on its own tiles, so
+  // onTile can be called from several threads at once, and memory use
+  // depends on the tile size and the number of threads, not the image size.
+  // Tiles come out the same as the same pixels of a whole-frame render.
+  //
+  // The denoiser needs its reach() of pixels around whatever it filters, so
+  // with denoising, tiles are rendered together in blocks at least eight
+  // times that reach across, each with that margin around it. The margins
+  // then cost at most about 1.6 times the image's rays, however small the
+  // tiles.
+  void renderTiles(const RayTraceScene &scene, int tileSize,
+                   const std::function<void(glm::ivec2 origin, glm::ivec2 size,
+                                            const RGBA *pixels)> &onTile);
+
+  // Renders the scene in passes into buffer until every pixel converges.
+  // onPass is called after each pass with the pass number and the number of
+  // pixels that were sampled in it. buffer can be read from onPass, while
+  // no pass is adding to it.
+  void renderProgressive(AccumulationBuffer &buffer,
+                         const RayTraceScene &scene,
+                         const std::function<void(int, int)> &onPass = {});
   void calcPhong(const glm::vec3 worldNormal, const glm::vec3 directionToCamera,
                  const glm::vec3 point, const SceneMaterial material,
                  const SceneLightData light, const float ka, const float kd,
-                 const float ks, glm::vec4 &illumination, RGBA curColor,
-                 float blend);
-  glm::vec4 traceRay(Ray &reflectedRayInWorld, const RayTraceScene &scene,
-                     glm::vec3 cameraPos, std::vector<glm::mat4> CTMs,
-                     std::vector<glm::mat4> inverseCTMs,
-                     std::vector<glm::mat3> transInverses,
-                     std::vector<SceneLightData> lights,
-                     std::vector<Primitive *> primitives, float ka, float kd,
-                     float ks, int depth);
+                 const float ks, glm::vec4 &illumination,
+                 glm::vec4 textureColor, float blend);
+
+  // A ray's closest hit: the ray parameter, the index of the primitive hit
+  // and the hit point in that primitive's object space.
+  struct Intersection {
+    float t;
+    int primitive;
+    glm::vec3 objectPoint;
+  };
+
+  // The camera sample a ray belongs to: its pixel, and its index among the
+  // pixel's samples. The sampler uses it to place secondary samples, such as
+  // shadow rays to area lights.
+  struct PixelSample {
+    int x;
+    int y;
+    std::uint32_t index;
+  };
+
+  // Returns the color seen along ray, following reflected and refracted rays
+  // until depth reaches zero. throughput is how much of what ray sees reaches
+  // the pixel.
+  glm::vec4 traceRay(const Ray &ray, const RayTraceScene &scene, int depth,
+                     const PixelSample &pixel, glm::vec3 throughput);
+
+  // Returns the color at hit, the closest intersection along ray.
+  // If albedo is given, the surface's diffuse color is written to it.
+  // Camera rays and bounces are shaded alike: the view direction is back
+  // along ray, reflected rays leave from just off the surface, and
+  // transparent surfaces refract at every bounce, not only at camera hits.
+  glm::vec4 shade(const Ray &ray, const Intersection &hit,
+                  const RayTraceScene &scene, int depth,
+                  const PixelSample &pixel, glm::vec3 throughput,
+                  glm::vec3 *albedo = nullptr);
+
+  // Returns what to scale a secondary ray's color by, given its throughput
+  // and a random number u in [0, 1), or zero if it isn't worth tracing.
+  float continuation(glm::vec3 throughput, float u) const;
+
+  // Adds the light from a rectangular area light at point, averaging point
+  // lights sampled over the light and tested for shadows.
+  void addAreaLight(const SceneLightData &light, const glm::vec3 worldNormal,
+                    const glm::vec3 directionToCamera, const glm::vec3 point,
+                    const SceneMaterial &material, const float ka,
+                    const float kd, const float ks, glm::vec4 &illumination,
+                    glm::vec4 textureColor, const RayTraceScene &scene,
+                    const PixelSample &pixel, int lightIndex, int dimension);
+
+  // A camera ray's color, with the primitive and world-space normal it hit
+  // (-1 and zero on a miss) for the supersampling edge tests, its depth for
+  // depth of field, and its albedo for the denoiser.
+  struct Sample {
+    glm::vec4 color;
+    int primitive;
+    glm::vec3 normal;
+    // The distance to the hit along the view axis, since camera rays'
+    // directions have unit depth; infinity on a miss
+    float depth;
+    // The diffuse color at the hit
+    glm::vec3 albedo;
+  };
+
+  // Traces a camera ray, recording what it hit.
+  Sample traceSample(const Ray &ray, const RayTraceScene &scene,
+                     const PixelSample &pixel);
+
+  // Returns true if two samples see a different primitive, a sharp change in
+  // normal or a change in color above the contrast threshold.
+  bool differs(const Sample &a, const Sample &b) const;
+
+  // Returns true if pixel (x, y) of a progressive render needs no more
+  // samples.
+  bool isConverged(const AccumulationBuffer &buffer, int x, int y) const;
+
+  // Finds the closest primitive hit by ray. Returns false if nothing is hit.
+  bool intersect(const Ray &ray, const RayTraceScene &scene,
+                 Intersection &hit) const;
+
+  // Returns true if any primitive blocks ray before the ray parameter maxT.
+  // For a shadow ray towards a light, pass the light's index: the primitive
+  // that last blocked a ray to it on this thread is tried first.
+  bool isOccluded(const Ray &ray, const RayTraceScene &scene,
+                  float maxT = INFINITY, int light = -1) const;
+
+  // How often shadow rays were blocked by the primitive that last blocked a
+  // ray to the same light, sparing a search of the scene
+  struct Stats {
+    std::uint64_t occluderCacheHits;
+    std::uint64_t occluderCacheMisses;
+  };
+
+  // Returns the statistics of every render so far.
+  Stats stats() const;
 
 private:
+  // Renders the pixels of the image from origin onwards into frame, which
+  // may cover only part of it, on the thread pool if parallel is set.
+  void renderRegion(FrameBuffer &frame, const RayTraceScene &scene,
+                    glm::ivec2 origin, bool parallel);
+
+  // Renders frame with one sample per pixel, or adaptively more for
+  // supersampling and depth of field, starting from pixel origin.
+  void renderSamples(FrameBuffer &frame, const RayTraceScene &scene,
+                     glm::ivec2 origin, bool parallel);
+
+  // Samples the pixels of the image from origin onwards in passes into
+  // buffer until every one converges, as for renderProgressive().
+  void renderPasses(AccumulationBuffer &buffer, const RayTraceScene &scene,
+                    glm::ivec2 origin, bool parallel,
+                    const std::function<void(int, int)> &onPass);
+
+  // Calls renderRow for rows 0 to height - 1, on the thread pool if parallel
+  // is set.
+  void forEachRow(int height, const std::function<void(int)> &renderRow,
+                  bool parallel) const;
+
+  // Adds this thread's occluder cache and texture tile counts to the totals
+  // and clears them.
+  void flushStats() const;
+
   const Config m_config;
+  const Sampler m_sampler;
+  mutable std::atomic<std::uint64_t> m_occluderCacheHits{0};
+  mutable std::atomic<std::uint64_t> m_occluderCacheMisses{0};
 };
@@ -5,39 +5,301 @@
 #include "geometry/cylinder.hpp"
 #include "geometry/primitive.h"
 #include "geometry/sphere.hpp"
+#include "texture/texturecache.h"
 #include "utils/sceneparser.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <stdexcept>
+#include <unordered_map>
 
-RayTraceScene::RayTraceScene(int width, int height, const RenderData &metaData)
-    : sceneCamera(metaData, width, height) {
+static bool sameMap(const SceneFileMap &a, const SceneFileMap &b) {
+  return a.isUsed == b.isUsed && a.filename == b.filename &&
+         a.repeatU == b.repeatU && a.repeatV == b.repeatV &&
+         a.compress == b.compress;
+}
+
+// Whether shapes are the same but for where they are
+static bool sameSurface(const RenderShapeData &a, const RenderShapeData &b) {
+  const SceneMaterial &m = a.primitive.material;
+  const SceneMaterial &n = b.primitive.material;
+  return a.primitive.type == b.primitive.type &&
+         a.primitive.meshfile == b.primitive.meshfile &&
+         m.cAmbient == n.cAmbient && m.cDiffuse == n.cDiffuse &&
+         m.cSpecular == n.cSpecular && m.shininess == n.shininess &&
+         m.cReflective == n.cReflective && m.cTransparent == n.cTransparent &&
+         m.ior == n.ior && sameMap(m.textureMap, n.textureMap) &&
+         m.blend == n.blend && m.cEmissive == n.cEmissive &&
+         sameMap(m.bumpMap, n.bumpMap);
+}
+
+static bool sameShape(const RenderShapeData &a, const RenderShapeData &b) {
+  return a.ctm == b.ctm && sameSurface(a, b);
+}
+
+// Hashes what most often tells shapes apart; sameShape() settles the rest
+static std::size_t hashShape(const RenderShapeData &shape) {
+  std::size_t hash = static_cast<std::size_t>(shape.primitive.type);
+  auto mix = [&](float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    hash ^= bits + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+  };
+  for (int column = 0; column < 4; column++) {
+    for (int row = 0; row < 4; row++) {
+      mix(shape.ctm[column][row]);
+    }
+  }
+  for (int channel = 0; channel < 4; channel++) {
+    mix(shape.primitive.material.cDiffuse[channel]);
+  }
+  return hash ^ std::hash<std::string>()(
+                    shape.primitive.material.textureMap.filename);
+}
+
+static bool sameLights(const std::vector<SceneLightData> &a,
+                       const std::vector<SceneLightData> &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < a.size(); i++) {
+    const SceneLightData &l = a[i];
+    const SceneLightData &m = b[i];
+    if (l.type != m.type || l.color != m.color || l.function != m.function ||
+        l.pos != m.pos || l.dir != m.dir || l.penumbra != m.penumbra ||
+        l.angle != m.angle || l.width != m.width || l.height != m.height) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Decodes every distinct texture of the given shapes once, in parallel,
+// before building primitives that share them
+static TextureCache::Textures
+preloadTextures(const std::vector<const RenderShapeData *> &shapes) {
+  std::vector<SceneFileMap> textureMaps;
+  for (const RenderShapeData *shape : shapes) {
+    if (shape->primitive.material.textureMap.filename != "") {
+      textureMaps.push_back(shape->primitive.material.textureMap);
+    }
+  }
+  return TextureCache::instance().preload(textureMaps);
+}
+
+RayTraceScene::RayTraceScene(int width, int height, const RenderData &metaData,
+                             float lightCutoff, float bvhRebuildThreshold)
+    : sceneCamera(metaData, width, height),
+      bvhRebuildThreshold(bvhRebuildThreshold) {
   sceneGlobalData = metaData.globalData;
   lights = metaData.lights;
+  lightIndex = LightIndex(lights, lightCutoff);
+  lightTree = LightTree(lights);
+  this->lightCutoff = lightCutoff;
+  sceneWidth = width;
+  sceneHeight = height;
+  shapes = metaData.shapes;
+
+  std::vector<const RenderShapeData *> toBuild;
+  for (const RenderShapeData &shape : shapes) {
+    toBuild.push_back(&shape);
+  }
+  TextureCache::Textures textures = preloadTextures(toBuild);
+
+  scenePrimitives.reserve(shapes.size());
+  inverseCTMs.reserve(shapes.size());
+  normalMatrices.reserve(shapes.size());
+
+  for (int i = 0; i < shapes.size(); i++) {
+    const RenderShapeData &shape = shapes[i];
+    scenePrimitives.push_back(makePrimitive(
+        shape, textures.find(shape.primitive.material.textureMap)));
+    glm::mat4 inverseCTM = glm::inverse(shape.ctm);
+    inverseCTMs.push_back(inverseCTM);
+    normalMatrices.push_back(glm::transpose(glm::mat3(inverseCTM)));
+  }
+  bvh.build(primitiveBounds());
+}
+
+Primitive *
+RayTraceScene::makePrimitive(const RenderShapeData &shape,
+                             std::shared_ptr<const Texture> texture) {
+  switch (shape.primitive.type) {
+  case PrimitiveType::PRIMITIVE_SPHERE:
+    return primitiveArena.make<Sphere>(shape.primitive.material, shape.ctm,
+                                       texture);
+  case PrimitiveType::PRIMITIVE_CUBE:
+    return primitiveArena.make<Cube>(shape.primitive.material, shape.ctm,
+                                     texture);
+  case PrimitiveType::PRIMITIVE_CONE:
+    return primitiveArena.make<Cone>(shape.primitive.material, shape.ctm,
+                                     texture);
+  case PrimitiveType::PRIMITIVE_CYLINDER:
+    return primitiveArena.make<Cylinder>(shape.primitive.material, shape.ctm,
+                                         texture);
+  default:
+    throw std::runtime_error("unimplemented primitive type");
+  }
+}
+
+std::vector<BVH::Bounds> RayTraceScene::primitiveBounds() const {
+  std::vector<BVH::Bounds> bounds;
+  bounds.reserve(shapes.size());
+  for (const RenderShapeData &shape : shapes) {
+    bounds.push_back(BVH::primitiveBounds(shape.ctm));
+  }
+  return bounds;
+}
+
+RayTraceScene::Changes RayTraceScene::update(const RenderData &metaData) {
+  return update(metaData, sceneWidth, sceneHeight);
+}
+
+RayTraceScene::Changes RayTraceScene::update(const RenderData &metaData,
+                                             int width, int height) {
+  Changes changes{0, 0, 0, false, false};
+
   sceneWidth = width;
   sceneHeight = height;
-  const std::vector<RenderShapeData> &shapes = metaData.shapes;
+  sceneCamera = Camera(metaData, sceneWidth, sceneHeight);
+  sceneGlobalData = metaData.globalData;
+  if (!sameLights(lights, metaData.lights)) {
+    lights = metaData.lights;
+    lightIndex = LightIndex(lights, lightCutoff);
+    lightTree = LightTree(lights);
+    changes.lightsChanged = true;
+  }
+
+  // Most edits leave shapes where they were, so those are matched in place,
+  // even if they moved. The rest are matched to an unused identical old
+  // shape, so that shapes survive edits that add, remove or reorder others.
+  const std::vector<RenderShapeData> &newShapes = metaData.shapes;
+  std::vector<int> matches(newShapes.size(), -1);
+  std::vector<bool> matched(shapes.size(), false);
+  for (int i = 0; i < std::min(shapes.size(), newShapes.size()); i++) {
+    if (sameSurface(shapes[i], newShapes[i])) {
+      matches[i] = i;
+      matched[i] = true;
+    }
+  }
+  std::unordered_multimap<std::size_t, int> unmatched;
   for (int i = 0; i < shapes.size(); i++) {
-    RenderShapeData shape = shapes[i];
-    switch (shape.primitive.type) {
-    case PrimitiveType::PRIMITIVE_SPHERE:
-      scenePrimitives.push_back(
-          new Sphere(shape.primitive.material, shape.ctm));
-      break;
-    case PrimitiveType::PRIMITIVE_CUBE:
-      scenePrimitives.push_back(new Cube(shape.primitive.material, shape.ctm));
-      break;
-    case PrimitiveType::PRIMITIVE_CONE:
-      scenePrimitives.push_back(new Cone(shape.primitive.material, shape.ctm));
-      break;
-    case PrimitiveType::PRIMITIVE_CYLINDER:
-      scenePrimitives.push_back(
-          new Cylinder(shape.primitive.material, shape.ctm));
-      break;
-    default:
-      throw std::runtime_error("unimplemented primitive type");
+    if (!matched[i]) {
+      unmatched.emplace(hashShape(shapes[i]), i);
+    }
+  }
+  std::vector<const RenderShapeData *> toBuild;
+  for (int i = 0; i < newShapes.size(); i++) {
+    if (matches[i] >= 0) {
+      continue;
+    }
+    auto [first, last] = unmatched.equal_range(hashShape(newShapes[i]));
+    for (auto candidate = first; candidate != last; ++candidate) {
+      if (sameShape(shapes[candidate->second], newShapes[i])) {
+        matches[i] = candidate->second;
+        unmatched.erase(candidate);
+        break;
+      }
+    }
+    if (matches[i] < 0) {
+      toBuild.push_back(&newShapes[i]);
+    }
+  }
+
+  // Replaced primitives stay in the arena until it's released, so once they
+  // outnumber the live ones everything is rebuilt into a fresh arena
+  int replaced = static_cast<int>(unmatched.size());
+  bool compact =
+      deadPrimitives + replaced > static_cast<int>(newShapes.size());
+  if (compact) {
+    std::fill(matches.begin(), matches.end(), -1);
+    toBuild.clear();
+    for (const RenderShapeData &shape : newShapes) {
+      toBuild.push_back(&shape);
+    }
+  }
+  // The cache only holds textures something still uses, so they're preloaded
+  // while the old primitives keep theirs alive
+  TextureCache::Textures textures = preloadTextures(toBuild);
+  std::vector<Primitive *> previous;
+  if (compact) {
+    primitiveArena.release();
+    deadPrimitives = 0;
+  } else {
+    deadPrimitives += replaced;
+    previous = std::move(scenePrimitives);
+  }
+
+  std::vector<glm::mat4> previousInverseCTMs = std::move(inverseCTMs);
+  std::vector<glm::mat3> previousNormalMatrices = std::move(normalMatrices);
+  scenePrimitives.clear();
+  inverseCTMs.clear();
+  normalMatrices.clear();
+  scenePrimitives.reserve(newShapes.size());
+  inverseCTMs.reserve(newShapes.size());
+  normalMatrices.reserve(newShapes.size());
+  for (int i = 0; i < newShapes.size(); i++) {
+    int match = matches[i];
+    if (match >= 0 && shapes[match].ctm != newShapes[i].ctm) {
+      Primitive *primitive = previous[match];
+      primitive->setCTM(newShapes[i].ctm);
+      scenePrimitives.push_back(primitive);
+      glm::mat4 inverseCTM = glm::inverse(newShapes[i].ctm);
+      inverseCTMs.push_back(inverseCTM);
+      normalMatrices.push_back(glm::transpose(glm::mat3(inverseCTM)));
+      changes.movedPrimitives++;
+      continue;
+    }
+    if (match >= 0) {
+      scenePrimitives.push_back(previous[match]);
+      inverseCTMs.push_back(previousInverseCTMs[match]);
+      normalMatrices.push_back(previousNormalMatrices[match]);
+      changes.reusedPrimitives++;
+      continue;
+    }
+    const RenderShapeData &shape = newShapes[i];
+    scenePrimitives.push_back(makePrimitive(
+        shape, textures.find(shape.primitive.material.textureMap)));
+    glm::mat4 inverseCTM = glm::inverse(shape.ctm);
+    inverseCTMs.push_back(inverseCTM);
+    normalMatrices.push_back(glm::transpose(glm::mat3(inverseCTM)));
+    changes.rebuiltPrimitives++;
+  }
+  // The BVH only knows the bounds at each index, which only depend on the
+  // transform there, whichever primitive now sits at it. So it's kept as is
+  // if no transform changed, refit if there are as many shapes as before,
+  // and only rebuilt when shapes were added or removed.
+  bool sameCount = shapes.size() == newShapes.size();
+  bool boundsChanged = !sameCount;
+  for (int i = 0; sameCount && i < newShapes.size(); i++) {
+    boundsChanged = boundsChanged || shapes[i].ctm != newShapes[i].ctm;
+  }
+
+  // Shapes matched in place are already equal but for their transforms
+  shapes.resize(newShapes.size());
+  for (int i = 0; i < newShapes.size(); i++) {
+    if (matches[i] != i) {
+      shapes[i] = newShapes[i];
+    } else {
+      shapes[i].ctm = newShapes[i].ctm;
+    }
+  }
+
+  if (!sameCount) {
+    bvh.build(primitiveBounds());
+    changes.bvhRebuilt = true;
+  } else if (boundsChanged) {
+    bvh.refit(primitiveBounds());
+    if (bvh.cost() > bvhRebuildThreshold * bvh.builtCost()) {
+      bvh.build(primitiveBounds());
+      changes.bvhRebuilt = true;
     }
   }
+
+  return changes;
 }
 
 const int &RayTraceScene::width() const { return sceneWidth; }
@@ -50,10 +312,24 @@ const SceneGlobalData &RayTraceScene::getGlobalData() const {
 
 const Camera &RayTraceScene::getCamera() const { return sceneCamera; }
 
-const std::vector<Primitive *> RayTraceScene::getPrimitives() const {
+const std::vector<Primitive *> &RayTraceScene::getPrimitives() const {
   return scenePrimitives;
 }
 
-const std::vector<SceneLightData> RayTraceScene::getLights() const {
+const std::vector<glm::mat4> &RayTraceScene::getInverseCTMs() const {
+  return inverseCTMs;
+}
+
+const std::vector<glm::mat3> &RayTraceScene::getNormalMatrices() const {
+  return normalMatrices;
+}
+
+const BVH &RayTraceScene::getBVH() const { return bvh; }
+
+const std::vector<SceneLightData> &RayTraceScene::getLights() const {
   return lights;
-}
\ No newline at end of file
+}
+
+const LightIndex &RayTraceScene::getLightIndex() const { return lightIndex; }
+
+const LightTree &RayTraceScene::getLightTree() const { return lightTree; }
@@ -1,9 +1,15 @@
 #pragma once
 
+#include "bvh.h"
 #include "camera/camera.h"
 #include "geometry/primitive.h"
+#include "lights/lightindex.h"
+#include "lights/lighttree.h"
+#include "texture/texture.h"
+#include "utils/arena.h"
 #include "utils/scenedata.h"
 #include "utils/sceneparser.h"
+#include <memory>
 
 // A class representing a scene to be ray-traced
 
@@ -17,13 +23,57 @@ class RayTraceScene {
 private:
   Camera sceneCamera;
   SceneGlobalData sceneGlobalData;
+  // Owns the primitives, which are all freed with the scene
+  Arena primitiveArena;
+  // Primitives replaced by update() but still held by the arena
+  int deadPrimitives = 0;
   std::vector<Primitive *> scenePrimitives;
+  // The shapes the primitives were made from, to diff against on update()
+  std::vector<RenderShapeData> shapes;
+  // Per-primitive transforms, indexed like scenePrimitives
+  std::vector<glm::mat4> inverseCTMs;
+  std::vector<glm::mat3> normalMatrices;
+  BVH bvh;
+  float bvhRebuildThreshold;
   std::vector<SceneLightData> lights;
+  LightIndex lightIndex;
+  LightTree lightTree;
+  float lightCutoff;
   int sceneWidth;
   int sceneHeight;
 
+  Primitive *makePrimitive(const RenderShapeData &shape,
+                           std::shared_ptr<const Texture> texture);
+
+  // The world bounds of each primitive, indexed like scenePrimitives
+  std::vector<BVH::Bounds> primitiveBounds() const;
+
 public:
-  RayTraceScene(int width, int height, const RenderData &metaData);
+  // What update() had to rebuild
+  struct Changes {
+    int reusedPrimitives;
+    int movedPrimitives; // Kept, but with a new transform
+    int rebuiltPrimitives;
+    bool lightsChanged;
+    bool bvhRebuilt; // Otherwise it was refit, if any bounds changed
+  };
+
+  // Lights are culled where they'd add less than lightCutoff to a color. The
+  // BVH is rebuilt once refitting it has made it bvhRebuildThreshold times as
+  // costly to trace as when it was built.
+  RayTraceScene(int width, int height, const RenderData &metaData,
+                float lightCutoff = LightIndex::DEFAULT_CUTOFF,
+                float bvhRebuildThreshold = BVH::DEFAULT_REBUILD_THRESHOLD);
+
+  // Updates the scene to an edited version of itself. Primitives whose shape
+  // is unchanged, wherever it moved in the list, are kept; only new or edited
+  // shapes are built, and the light structures only if the lights changed.
+  // Shapes that only changed transform in place, as animated ones do, are
+  // moved, and if nothing else changed the BVH is refit rather than rebuilt.
+  Changes update(const RenderData &metaData);
+
+  // Updates the scene as above, and renders it at a new size.
+  Changes update(const RenderData &metaData, int width, int height);
 
   const int &width() const;
 
@@ -33,7 +83,23 @@ public:
 
   const Camera &getCamera() const;
 
-  const std::vector<Primitive *> getPrimitives() const;
+  const std::vector<Primitive *> &getPrimitives() const;
+
+  // Returns the world-to-object matrix of each primitive.
+  const std::vector<glm::mat4> &getInverseCTMs() const;
+
+  // Returns the object-to-world normal matrix of each primitive.
+  const std::vector<glm::mat3> &getNormalMatrices() const;
+
+  // Returns the hierarchy over the primitives' bounds.
+  const BVH &getBVH() const;
+
+  const std::vector<SceneLightData> &getLights() const;
+
+  // Returns the lights indexed by their reach, to find those that can light
+  // a point.
+  const LightIndex &getLightIndex() const;
 
-  const std::vector<SceneLightData> getLights() const;
+  // Returns the lights in a hierarchy, to pick a few of them at random.
+  const LightTree &getLightTree() const;
 };
@@ -0,0 +1,207 @@
+#include "tiledimagefile.h"
+#include "utils/littleendianwriter.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+// Field types of TIFF directory entries
+constexpr std::uint16_t SHORT = 3;
+constexpr std::uint16_t LONG = 4;
+constexpr std::uint16_t LONG8 = 16;
+
+std::size_t typeSize(std::uint16_t type) {
+  return type == SHORT ? 2 : type == LONG ? 4 : 8;
+}
+
+struct Entry {
+  std::uint16_t tag;
+  std::uint16_t type;
+  std::uint64_t count;
+  LittleEndianWriter values;
+};
+
+// Returns the header, directory and tile tables of a tiled RGB file, and sets
+// dataOffset to where its tiles begin. BigTIFF widens offsets and counts to
+// 64 bits.
+std::string tiffHeader(bool big, std::uint32_t width, std::uint32_t height,
+                       std::uint32_t tileSize, std::uint64_t tileCount,
+                       std::uint64_t &dataOffset) {
+  std::vector<Entry> entries(11);
+  auto set = [&](int i, std::uint16_t tag, std::uint16_t type,
+                 std::uint64_t count) {
+    entries[i].tag = tag;
+    entries[i].type = type;
+    entries[i].count = count;
+    return &entries[i].values;
+  };
+  set(0, 256, LONG, 1)->uint32(width);
+  set(1, 257, LONG, 1)->uint32(height);
+  LittleEndianWriter *bitsPerSample = set(2, 258, SHORT, 3);
+  for (int channel = 0; channel < 3; channel++) {
+    bitsPerSample->uint16(8);
+  }
+  set(3, 259, SHORT, 1)->uint16(1); // No compression
+  set(4, 262, SHORT, 1)->uint16(2); // RGB
+  set(5, 277, SHORT, 1)->uint16(3); // Samples per pixel
+  set(6, 284, SHORT, 1)->uint16(1); // Channels interleaved
+  set(7, 322, LONG, 1)->uint32(tileSize);
+  set(8, 323, LONG, 1)->uint32(tileSize);
+  LittleEndianWriter *tileOffsets = set(9, 324, big ? LONG8 : LONG, tileCount);
+  LittleEndianWriter *tileByteCounts = set(10, 325, LONG, tileCount);
+  std::uint32_t tileBytes = 3 * tileSize * tileSize;
+  for (std::uint64_t i = 0; i < tileCount; i++) {
+    tileByteCounts->uint32(tileBytes);
+  }
+
+  // Values too big for their entry's slot follow the directory, each at an
+  // even offset, and the tiles follow them
+  std::size_t slot = big ? 8 : 4;
+  std::uint64_t directoryEnd = big ? 16 + 8 + entries.size() * 20 + 8
+                                   : 8 + 2 + entries.size() * 12 + 4;
+  dataOffset = directoryEnd;
+  for (const Entry &entry : entries) {
+    std::uint64_t size = entry.count * typeSize(entry.type);
+    if (size > slot) {
+      dataOffset += size + size % 2;
+    }
+  }
+  for (std::uint64_t i = 0; i < tileCount; i++) {
+    std::uint64_t tileOffset = dataOffset + i * tileBytes;
+    if (big) {
+      tileOffsets->uint64(tileOffset);
+    } else {
+      tileOffsets->uint32(static_cast<std::uint32_t>(tileOffset));
+    }
+  }
+
+  LittleEndianWriter header;
+  header.bytes = "II";
+  if (big) {
+    header.uint16(43);
+    header.uint16(8); // Offset size
+    header.uint16(0);
+    header.uint64(16); // Directory offset
+    header.uint64(entries.size());
+  } else {
+    header.uint16(42);
+    header.uint32(8);
+    header.uint16(static_cast<std::uint16_t>(entries.size()));
+  }
+  std::uint64_t valueOffset = directoryEnd;
+  LittleEndianWriter values;
+  for (const Entry &entry : entries) {
+    header.uint16(entry.tag);
+    header.uint16(entry.type);
+    if (big) {
+      header.uint64(entry.count);
+    } else {
+      header.uint32(static_cast<std::uint32_t>(entry.count));
+    }
+    const std::string &bytes = entry.values.bytes;
+    if (bytes.size() <= slot) {
+      // Values that fit are stored in the slot, left-justified
+      header.bytes += bytes;
+      header.bytes.append(slot - bytes.size(), '\0');
+    } else {
+      if (big) {
+        header.uint64(valueOffset);
+      } else {
+        header.uint32(static_cast<std::uint32_t>(valueOffset));
+      }
+      values.bytes += bytes;
+      values.bytes.append(bytes.size() % 2, '\0');
+      valueOffset += bytes.size() + bytes.size() % 2;
+    }
+  }
+  // No further directories
+  if (big) {
+    header.uint64(0);
+  } else {
+    header.uint32(0);
+  }
+  return header.bytes + values.bytes;
+}
+
+} // namespace
+
+std::unique_ptr<TiledImageFile>
+TiledImageFile::create(const std::string &filename, int width, int height,
+                       int tileSize) {
+  std::unique_ptr<TiledImageFile> image(new TiledImageFile());
+  image->m_filename = filename;
+  image->m_width = width;
+  image->m_height = height;
+  image->m_tileSize = std::max((tileSize + 15) / 16 * 16, 16);
+  tileSize = image->m_tileSize;
+
+  std::uint64_t tileCount =
+      static_cast<std::uint64_t>((width + tileSize - 1) / tileSize) *
+      ((height + tileSize - 1) / tileSize);
+  std::uint64_t tileBytes = 3ull * tileSize * tileSize;
+  // TIFF offsets are 32 bits, so bigger files have to be BigTIFFs
+  std::string header = tiffHeader(false, width, height, tileSize, tileCount,
+                                  image->m_dataOffset);
+  if (image->m_dataOffset + tileCount * tileBytes > UINT32_MAX) {
+    header = tiffHeader(true, width, height, tileSize, tileCount,
+                        image->m_dataOffset);
+  }
+
+  // The tiles are left as a hole in the file until they're written
+  image->m_file.setFileName(QString::fromStdString(filename));
+  if (!image->m_file.open(QFile::ReadWrite | QFile::Truncate) ||
+      image->m_file.write(header.data(), header.size()) !=
+          static_cast<qint64>(header.size()) ||
+      !image->m_file.resize(image->m_dataOffset + tileCount * tileBytes)) {
+    std::cout << "could not open " << filename << " for writing" << std::endl;
+    return nullptr;
+  }
+  return image;
+}
+
+bool TiledImageFile::writeTile(int x, int y, const RGBA *pixels) {
+  std::uint64_t index =
+      static_cast<std::uint64_t>(y / m_tileSize) *
+          ((m_width + m_tileSize - 1) / m_tileSize) +
+      x / m_tileSize;
+  std::uint64_t tileBytes = 3ull * m_tileSize * m_tileSize;
+  uchar *data;
+  {
+    // Mapping changes the file's table of maps; filling the tile doesn't
+    std::lock_guard<std::mutex> lock(m_fileMutex);
+    data = m_file.map(m_dataOffset + index * tileBytes, tileBytes);
+  }
+  if (!data) {
+    std::cout << "could not map a tile of " << m_filename << std::endl;
+    m_failed = true;
+    return false;
+  }
+
+  int width = std::min(m_tileSize, m_width - x);
+  int height = std::min(m_tileSize, m_height - y);
+  for (int row = 0; row < height; row++) {
+    uchar *destination = data + 3ull * row * m_tileSize;
+    const RGBA *source = pixels + row * width;
+    for (int column = 0; column < width; column++) {
+      destination[3 * column] = source[column].r;
+      destination[3 * column + 1] = source[column].g;
+      destination[3 * column + 2] = source[column].b;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(m_fileMutex);
+  m_file.unmap(data);
+  return true;
+}
+
+bool TiledImageFile::close() {
+  bool written = !m_failed && m_file.flush();
+  m_file.close();
+  if (!written) {
+    std::cout << "could not write " << m_filename << std::endl;
+    QFile::remove(QString::fromStdString(m_filename));
+  }
+  return written;
+}
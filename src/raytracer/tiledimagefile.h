@@ -0,0 +1,52 @@
+#pragma once
+
+#include "utils/rgba.h"
+#include <QFile>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// An 8-bit RGB image written to disk a tile at a time, for images too big to
+// hold in memory.
+
+// The file is a tiled, uncompressed TIFF, or a BigTIFF once it outgrows the
+// 4 GB that TIFF offsets can address. The header and tile tables are written
+// up front, since every tile has a fixed place in the file, and the file is
+// then sized to fit. Each tile is written by mapping just its own bytes into
+// memory, so tiles can be written from several threads in any order, and
+// only those in flight are held in memory. Edge tiles are padded with black.
+
+class TiledImageFile {
+public:
+  // Creates filename for a width x height image. tileSize is rounded up to a
+  // multiple of 16, as TIFF requires. Returns nullptr if the file could not
+  // be created.
+  static std::unique_ptr<TiledImageFile>
+  create(const std::string &filename, int width, int height, int tileSize);
+
+  int tileSize() const { return m_tileSize; }
+
+  // Writes the tile whose top-left pixel is (x, y), which must lie on the
+  // tile grid. pixels holds the tile's pixels that are inside the image, row
+  // by row; their alpha is dropped. Returns false if the tile could not be
+  // written.
+  bool writeTile(int x, int y, const RGBA *pixels);
+
+  // Finishes the file. Returns false if it or any tile could not be written,
+  // in which case the file is removed.
+  bool close();
+
+private:
+  TiledImageFile() = default;
+
+  std::string m_filename;
+  int m_width;
+  int m_height;
+  int m_tileSize;
+  std::uint64_t m_dataOffset; // Byte offset of the first tile
+  QFile m_file;
+  std::mutex m_fileMutex;
+  std::atomic<bool> m_failed = false;
+};
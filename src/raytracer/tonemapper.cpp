@@ -0,0 +1,148 @@
+#include "tonemapper.h"
+
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <glm/gtc/type_ptr.hpp>
+#include <vector>
+
+namespace {
+
+// Pixels converted per step, small enough for their channels to stay in L1
+constexpr int BLOCK_SIZE = 64;
+
+// sRGB-encoded values, scaled to [0, 255], of linear values i / SRGB_STEPS.
+// The steps are fine enough that neighbouring entries never differ by more
+// than a fifth of an 8-bit level.
+constexpr int SRGB_STEPS = 16384;
+
+const std::array<float, SRGB_STEPS + 1> &srgbTable() {
+  static const std::array<float, SRGB_STEPS + 1> table = [] {
+    std::array<float, SRGB_STEPS + 1> table;
+    for (int i = 0; i <= SRGB_STEPS; i++) {
+      double linear = static_cast<double>(i) / SRGB_STEPS;
+      double encoded = linear <= 0.0031308
+                           ? 12.92 * linear
+                           : 1.055 * std::pow(linear, 1 / 2.4) - 0.055;
+      table[i] = static_cast<float>(255 * encoded);
+    }
+    return table;
+  }();
+  return table;
+}
+
+// The 8x8 Bayer matrix, as thresholds in [0, 1) centred on their cells
+float bayerThreshold(int x, int y) {
+  int value = 0;
+  for (int bit = 0; bit < 3; bit++) {
+    int shift = 2 * (2 - bit);
+    value |= (((x ^ y) >> bit) & 1) << (shift + 1);
+    value |= ((y >> bit) & 1) << shift;
+  }
+  return (value + 0.5f) / 64;
+}
+
+} // namespace
+
+ToneMapper::ToneMapper() : ToneMapper(Settings{}) {}
+
+ToneMapper::ToneMapper(Settings settings) : m_settings(settings) {}
+
+void ToneMapper::resolve(const FrameBuffer &frame, RGBA *imageData) const {
+  std::vector<glm::ivec2> tiles;
+  for (int y = 0; y < frame.height(); y += TILE_SIZE) {
+    for (int x = 0; x < frame.width(); x += TILE_SIZE) {
+      tiles.push_back(glm::ivec2(x, y));
+    }
+  }
+  // Tiles only write their own pixels, so they can run in any order
+  auto resolveTile = [&](const glm::ivec2 &tile) {
+    resolve(frame,
+            imageData + static_cast<std::size_t>(tile.y) * frame.width() +
+                tile.x,
+            frame.width(), tile.x, tile.y,
+            std::min(tile.x + TILE_SIZE, frame.width()),
+            std::min(tile.y + TILE_SIZE, frame.height()));
+  };
+  if (m_settings.parallel) {
+    QtConcurrent::blockingMap(tiles, resolveTile);
+  } else {
+    std::for_each(tiles.begin(), tiles.end(), resolveTile);
+  }
+}
+
+void ToneMapper::resolve(const FrameBuffer &frame, RGBA *imageData,
+                         int stride, int x0, int y0, int x1, int y1,
+                         glm::ivec2 origin) const {
+  const std::array<float, SRGB_STEPS + 1> &srgb = srgbTable();
+  const float exposure = m_settings.exposure;
+  // Quantizing truncates; sRGB is rounded instead, which dithering does too
+  // on average. Linear output is truncated to match toRGBA().
+  const float rounding =
+      m_settings.encoding == Encoding::SRGB && !m_settings.dither ? 0.5f : 0;
+
+  // Each block holds the four channels of BLOCK_SIZE pixels, and is worked
+  // on a whole channel array at a time. std::max(0.0f, c) is written that
+  // way round so that NaN clamps to 0.
+  float channels[4 * BLOCK_SIZE];
+  float offsets[4 * BLOCK_SIZE];
+  std::int32_t levels[4 * BLOCK_SIZE];
+
+  for (int y = y0; y < y1; y++) {
+    // Blocks are a multiple of 8 pixels wide, so every block of the row
+    // sees the same dither thresholds
+    for (int i = 0; i < 4 * BLOCK_SIZE; i++) {
+      offsets[i] = m_settings.dither
+                       ? bayerThreshold(origin.x + x0 + i / 4, origin.y + y)
+                       : rounding;
+    }
+
+    for (int x = x0; x < x1; x += BLOCK_SIZE) {
+      const int n = 4 * std::min(BLOCK_SIZE, x1 - x);
+      const float *source = glm::value_ptr(frame.color(x, y));
+      std::uint8_t *destination = reinterpret_cast<std::uint8_t *>(
+          imageData + static_cast<std::size_t>(y - y0) * stride + (x - x0));
+
+      for (int i = 0; i < n; i++) {
+        channels[i] = std::max(0.0f, source[i] * exposure);
+      }
+      if (m_settings.toneMap == Operator::Reinhard) {
+        for (int i = 0; i < n; i++) {
+          channels[i] = channels[i] / (1 + channels[i]);
+        }
+      } else if (m_settings.toneMap == Operator::ACES) {
+        for (int i = 0; i < n; i++) {
+          float c = channels[i];
+          channels[i] =
+              c * (2.51f * c + 0.03f) / (c * (2.43f * c + 0.59f) + 0.14f);
+        }
+      }
+
+      if (m_settings.encoding == Encoding::SRGB) {
+        for (int i = 0; i < n; i++) {
+          float c = std::min(channels[i], 1.0f);
+          channels[i] = srgb[static_cast<int>(c * SRGB_STEPS + 0.5f)];
+        }
+      } else {
+        for (int i = 0; i < n; i++) {
+          channels[i] = std::min(channels[i] * 255, 255.0f);
+        }
+      }
+
+      // Converting to integers and narrowing them are separate loops, as
+      // each vectorizes on its own but not together
+      for (int i = 0; i < n; i++) {
+        levels[i] = static_cast<std::int32_t>(
+            std::min(channels[i] + offsets[i], 255.0f));
+      }
+      for (int i = 0; i < n; i++) {
+        destination[i] = static_cast<std::uint8_t>(levels[i]);
+      }
+      for (int i = 3; i < n; i += 4) {
+        destination[i] = 255;
+      }
+    }
+  }
+}
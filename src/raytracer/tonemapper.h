@@ -0,0 +1,58 @@
+#pragma once
+
+#include "framebuffer.h"
+#include "utils/rgba.h"
+#include <glm/glm.hpp>
+
+// Turns a frame's linear float colors into 8-bit pixels.
+
+// Each color is scaled by the exposure, compressed by the tone-map operator,
+// clamped to [0, 1], encoded and quantized. sRGB encoding reads a table
+// rather than evaluating the transfer function per channel. Ordered dithering
+// adds an 8x8 Bayer threshold before quantizing, trading the banding of smooth
+// gradients for fine, even noise.
+//
+// Rows are processed a block of channels at a time in straight loops the
+// compiler can vectorize; only the sRGB table lookup stays scalar. With the
+// defaults, pixels come out exactly as toRGBA() makes them.
+
+class ToneMapper {
+public:
+  enum class Operator {
+    Clamp,    // Colors above 1 are clipped
+    Reinhard, // c / (1 + c), per channel
+    ACES      // Narkowicz's fit of the ACES filmic curve
+  };
+
+  enum class Encoding { Linear, SRGB };
+
+  struct Settings {
+    Operator toneMap = Operator::Clamp;
+    Encoding encoding = Encoding::Linear;
+    float exposure = 1.0f;
+    bool dither = false;
+    bool parallel = true;
+  };
+
+  static constexpr int TILE_SIZE = 64;
+
+  // With the default settings
+  ToneMapper();
+  ToneMapper(Settings settings);
+
+  // Resolves all of frame into imageData, a tile at a time.
+  void resolve(const FrameBuffer &frame, RGBA *imageData) const;
+
+  // Resolves the pixels of frame from (x0, y0) up to (x1, y1) into imageData,
+  // which starts at pixel (x0, y0) and holds rows stride pixels apart.
+  // Renderers that finish the frame piece by piece can resolve each piece as
+  // it completes. If frame is itself part of a bigger image, origin is where
+  // its top-left pixel lies in that image, which keeps the dither pattern
+  // seamless across frames.
+  void resolve(const FrameBuffer &frame, RGBA *imageData, int stride, int x0,
+               int y0, int x1, int y1,
+               glm::ivec2 origin = glm::ivec2(0, 0)) const;
+
+private:
+  Settings m_settings;
+};
@@ -0,0 +1,147 @@
+#include "bluenoise.h"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+constexpr int COUNT = BlueNoise::SIZE * BlueNoise::SIZE;
+// Gaussian filter used to measure how crowded a pixel's neighbourhood is;
+// beyond RADIUS its weight is negligible
+constexpr float SIGMA = 1.5f;
+constexpr int RADIUS = 6;
+
+// A binary pattern on the torus with the filtered density of its ones
+class Pattern {
+public:
+  Pattern() : m_ones(COUNT, false), m_energy(COUNT, 0) {
+    for (int dy = -RADIUS; dy <= RADIUS; dy++) {
+      for (int dx = -RADIUS; dx <= RADIUS; dx++) {
+        m_kernel.push_back(
+            std::exp(-(dx * dx + dy * dy) / (2 * SIGMA * SIGMA)));
+      }
+    }
+  }
+
+  bool isOne(int index) const { return m_ones[index]; }
+
+  void set(int index, bool one) {
+    if (m_ones[index] == one) {
+      return;
+    }
+    m_ones[index] = one;
+    float sign = one ? 1.0f : -1.0f;
+    int x = index % BlueNoise::SIZE;
+    int y = index / BlueNoise::SIZE;
+    int k = 0;
+    for (int dy = -RADIUS; dy <= RADIUS; dy++) {
+      int row = (y + dy + BlueNoise::SIZE) % BlueNoise::SIZE;
+      for (int dx = -RADIUS; dx <= RADIUS; dx++, k++) {
+        int column = (x + dx + BlueNoise::SIZE) % BlueNoise::SIZE;
+        m_energy[row * BlueNoise::SIZE + column] += sign * m_kernel[k];
+      }
+    }
+  }
+
+  // The one with the most crowded neighbourhood
+  int tightestCluster() const {
+    int best = -1;
+    for (int i = 0; i < COUNT; i++) {
+      if (m_ones[i] && (best == -1 || m_energy[i] > m_energy[best])) {
+        best = i;
+      }
+    }
+    return best;
+  }
+
+  // The zero with the emptiest neighbourhood
+  int largestVoid() const {
+    int best = -1;
+    for (int i = 0; i < COUNT; i++) {
+      if (!m_ones[i] && (best == -1 || m_energy[i] < m_energy[best])) {
+        best = i;
+      }
+    }
+    return best;
+  }
+
+private:
+  std::vector<bool> m_ones;
+  std::vector<float> m_energy;
+  std::vector<float> m_kernel;
+};
+
+std::vector<float> buildMask() {
+  std::vector<int> ranks(COUNT, 0);
+
+  // Seed a tenth of the pixels at fixed pseudo-random positions, then move
+  // ones from clusters into voids until the pattern is evenly spread
+  Pattern initial;
+  int initialOnes = COUNT / 10;
+  std::uint32_t state = 0x2545f491u;
+  for (int placed = 0; placed < initialOnes;) {
+    state = state * 1664525u + 1013904223u;
+    int index = (state >> 8) % COUNT;
+    if (!initial.isOne(index)) {
+      initial.set(index, true);
+      placed++;
+    }
+  }
+  while (true) {
+    int cluster = initial.tightestCluster();
+    initial.set(cluster, false);
+    int gap = initial.largestVoid();
+    initial.set(gap, true);
+    if (gap == cluster) {
+      break;
+    }
+  }
+
+  // Rank the initial ones by removing the most clustered first
+  Pattern pattern = initial;
+  for (int rank = initialOnes - 1; rank >= 0; rank--) {
+    int cluster = pattern.tightestCluster();
+    pattern.set(cluster, false);
+    ranks[cluster] = rank;
+  }
+
+  // Fill the largest voids up to half the pixels
+  pattern = initial;
+  int rank = initialOnes;
+  for (; rank < COUNT / 2; rank++) {
+    int gap = pattern.largestVoid();
+    pattern.set(gap, true);
+    ranks[gap] = rank;
+  }
+
+  // Past half, the zeros are the minority: track their density instead and
+  // fill the most crowded zero each time
+  Pattern zeros;
+  for (int i = 0; i < COUNT; i++) {
+    zeros.set(i, !pattern.isOne(i));
+  }
+  for (; rank < COUNT; rank++) {
+    int cluster = zeros.tightestCluster();
+    zeros.set(cluster, false);
+    ranks[cluster] = rank;
+  }
+
+  std::vector<float> mask(COUNT);
+  for (int i = 0; i < COUNT; i++) {
+    mask[i] = static_cast<float>(ranks[i]) / COUNT;
+  }
+  return mask;
+}
+
+} // namespace
+
+float BlueNoise::value(int x, int y) {
+  x &= SIZE - 1;
+  y &= SIZE - 1;
+  return mask()[y * SIZE + x];
+}
+
+const float *BlueNoise::mask() {
+  static const std::vector<float> mask = buildMask();
+  return mask.data();
+}
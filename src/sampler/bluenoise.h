@@ -0,0 +1,18 @@
+#pragma once
+
+// A tileable blue-noise mask, built once on first use with Ulichney's
+// void-and-cluster method.
+
+// Every value in [0, SIZE * SIZE) appears once, and any threshold of the mask
+// gives evenly spread, clump-free pixels, also across the tile's edges.
+
+class BlueNoise {
+public:
+  static constexpr int SIZE = 64;
+
+  // Returns the mask value at (x, y), wrapping, scaled to [0, 1).
+  static float value(int x, int y);
+
+private:
+  static const float *mask();
+};
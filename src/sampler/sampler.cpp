@@ -0,0 +1,115 @@
+#include "sampler.h"
+#include "bluenoise.h"
+#include <cmath>
+
+namespace {
+
+std::uint32_t reverseBits(std::uint32_t x) {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// The lowbias32 integer hash
+std::uint32_t hash(std::uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+std::uint32_t hashCombine(std::uint32_t seed, std::uint32_t value) {
+  return seed ^ (hash(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// Owen scrambling: flips each bit depending on a hash of the bits above it,
+// which permutes the points within every dyadic interval but keeps their
+// stratification. The multiplies only carry upwards, so they run on the
+// bit-reversed value (Laine and Karras 2011, with Burley's constants).
+std::uint32_t nestedUniformScramble(std::uint32_t x, std::uint32_t seed) {
+  x = reverseBits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverseBits(x);
+}
+
+// The first two Sobol' dimensions, as 32-bit fractions
+std::uint32_t sobol0(std::uint32_t index) { return reverseBits(index); }
+
+std::uint32_t sobol1(std::uint32_t index) {
+  std::uint32_t result = 0;
+  for (std::uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+    if (index & 1) {
+      result ^= v;
+    }
+  }
+  return result;
+}
+
+float toUnit(std::uint32_t x) { return (x >> 8) * (1.0f / (1 << 24)); }
+
+// Adds an offset on the unit torus
+float rotate(float value, float offset) {
+  value += offset;
+  return value >= 1 ? value - 1 : value;
+}
+
+} // namespace
+
+Sampler::Sampler(Type type, std::uint32_t seed) : m_type(type), m_seed(seed) {}
+
+glm::vec2 Sampler::get2D(int x, int y, std::uint32_t sampleIndex,
+                         int dimension) const {
+  std::uint32_t dimensionSeed =
+      hash(hashCombine(m_seed, static_cast<std::uint32_t>(dimension)));
+  if (m_type == Type::Sobol) {
+    std::uint32_t pixelSeed = hash(
+        hashCombine(hashCombine(dimensionSeed, static_cast<std::uint32_t>(x)),
+                    static_cast<std::uint32_t>(y)));
+    std::uint32_t index = nestedUniformScramble(sampleIndex, pixelSeed);
+    return glm::vec2(
+        toUnit(nestedUniformScramble(sobol0(index), hashCombine(pixelSeed, 0))),
+        toUnit(
+            nestedUniformScramble(sobol1(index), hashCombine(pixelSeed, 1))));
+  }
+
+  // Every pixel walks the same sequence, shifted by its blue-noise value; a
+  // different region of the mask for each dimension and axis keeps them
+  // uncorrelated
+  std::uint32_t index = nestedUniformScramble(sampleIndex, dimensionSeed);
+  glm::vec2 point(toUnit(nestedUniformScramble(sobol0(index),
+                                               hashCombine(dimensionSeed, 0))),
+                  toUnit(nestedUniformScramble(sobol1(index),
+                                               hashCombine(dimensionSeed, 1))));
+  int offsetX = dimensionSeed & (BlueNoise::SIZE - 1);
+  int offsetY = (dimensionSeed >> 8) & (BlueNoise::SIZE - 1);
+  return glm::vec2(
+      rotate(point.x, BlueNoise::value(x + offsetX, y + offsetY)),
+      rotate(point.y, BlueNoise::value(x + offsetX + BlueNoise::SIZE / 2,
+                                       y + offsetY + BlueNoise::SIZE / 3)));
+}
+
+glm::vec2 Sampler::squareToDisk(glm::vec2 point) {
+  glm::vec2 offset = 2.0f * point - 1.0f;
+  if (offset.x == 0 && offset.y == 0) {
+    return glm::vec2(0, 0);
+  }
+  float radius;
+  float theta;
+  if (std::abs(offset.x) > std::abs(offset.y)) {
+    radius = offset.x;
+    theta = static_cast<float>(M_PI / 4) * (offset.y / offset.x);
+  } else {
+    radius = offset.y;
+    theta = static_cast<float>(M_PI / 2) -
+            static_cast<float>(M_PI / 4) * (offset.x / offset.y);
+  }
+  return radius * glm::vec2(std::cos(theta), std::sin(theta));
+}
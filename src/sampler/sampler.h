@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Sample points for anything that integrates over a pixel: supersampling,
+// progressive rendering, depth of field and area lights.
+
+// A sample point is a pure function of the pixel, the sample index within the
+// pixel, the dimension pair being sampled and the seed. No state is kept
+// between calls, so a render produces the same image whatever the thread
+// count or the order pixels are visited in.
+//
+// Sobol points come from the first two Sobol' dimensions, shuffled and
+// Owen-scrambled with a hash of the pixel and dimension (Burley 2020). Every
+// power-of-two prefix of a pixel's samples is stratified, and pixels are
+// decorrelated from each other.
+//
+// BlueNoise points use the same Sobol' points, scrambled per dimension only,
+// and rotate them per pixel by a blue-noise mask (Georgiev and Fajardo 2016).
+// Each pixel stays stratified, and the remaining error across neighbouring
+// pixels is high-frequency, which reads as finer, less objectionable noise.
+
+class Sampler {
+public:
+  enum class Type { Sobol, BlueNoise };
+
+  // Dimension pairs used by the renderer, so that features sampled together
+  // stay decorrelated
+  static constexpr int PIXEL = 0;
+  static constexpr int LENS = 1;
+  static constexpr int LIGHT_SELECTION = 2;
+  static constexpr int ROULETTE = 3;
+  static constexpr int LIGHT = 4;
+
+  Sampler(Type type = Type::Sobol, std::uint32_t seed = 0);
+
+  // Returns the point in [0, 1)^2 for sample sampleIndex of pixel (x, y) in
+  // the given dimension pair.
+  glm::vec2 get2D(int x, int y, std::uint32_t sampleIndex,
+                  int dimension) const;
+
+  // Maps a point in [0, 1)^2 onto the unit disk, keeping its stratification
+  // (Shirley and Chiu's concentric mapping).
+  static glm::vec2 squareToDisk(glm::vec2 point);
+
+private:
+  Type m_type;
+  std::uint32_t m_seed;
+};
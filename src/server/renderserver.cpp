@@ -0,0 +1,354 @@
+#include "renderserver.h"
+#include "raytracer/accumulationbuffer.h"
+#include "raytracer/framebuffer.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QUrl>
+#include <QUrlQuery>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <new>
+
+namespace {
+
+// Requests are a request line and a few headers; anything bigger is refused
+constexpr int MAX_HEADER_SIZE = 64 << 10;
+
+RenderServer::Reply errorReply(int status, const std::string &message) {
+  std::cout << "Render request failed: " << message << std::endl;
+  return RenderServer::Reply{
+      status, "text/plain", QByteArray::fromStdString(message + "\n"), {}};
+}
+
+QByteArray reasonPhrase(int status) {
+  switch (status) {
+  case 200:
+    return "OK";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 431:
+    return "Request Header Fields Too Large";
+  default:
+    return "Internal Server Error";
+  }
+}
+
+// Parses "x,y,z" into v. Returns false if it isn't three numbers.
+bool parseVector(const QString &text, glm::vec4 &v) {
+  QStringList parts = text.split(',');
+  if (parts.size() != 3) {
+    return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    bool ok;
+    v[i] = parts[i].toFloat(&ok);
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Replaces the parts of camera the request sets, as a <cameradata> tag's
+// children would. Returns false, setting error, if one can't be parsed.
+bool overrideCamera(const RenderServer::Settings &request,
+                    SceneCameraData &camera, std::string &error) {
+  auto vector = [&](const char *key, glm::vec4 &v, float w) {
+    QString text = request(key, {}).toString();
+    if (text.isEmpty()) {
+      return false;
+    }
+    glm::vec4 parsed = v;
+    if (!parseVector(text, parsed)) {
+      error = std::string("could not parse ") + key;
+      return false;
+    }
+    v = glm::vec4(glm::vec3(parsed), w);
+    return true;
+  };
+  auto number = [&](const char *key, float &value) {
+    QVariant text = request(key, {});
+    if (text.toString().isEmpty()) {
+      return false;
+    }
+    bool ok;
+    float parsed = text.toFloat(&ok);
+    if (!ok) {
+      error = std::string("could not parse ") + key;
+      return false;
+    }
+    value = parsed;
+    return true;
+  };
+
+  vector("Camera/pos", camera.pos, 1);
+  vector("Camera/up", camera.up, 0);
+  bool lookSet = vector("Camera/look", camera.look, 0);
+  glm::vec4 focus;
+  bool focusSet = vector("Camera/focus", focus, 1);
+  float heightAngle;
+  if (number("Camera/heightangle", heightAngle)) {
+    camera.heightAngle = glm::radians(heightAngle);
+  }
+  number("Camera/aperture", camera.aperture);
+  bool focalLengthSet = number("Camera/focallength", camera.focalLength);
+  if (!error.empty()) {
+    return false;
+  }
+
+  if (lookSet && focusSet) {
+    error = "the camera can not have both look and focus";
+    return false;
+  }
+  if (focusSet) {
+    // Unless told otherwise, keep the focus point in focus
+    camera.look = focus - camera.pos;
+    if (!focalLengthSet) {
+      camera.focalLength = glm::length(glm::vec3(camera.look));
+    }
+  }
+  if (camera.aperture < 0 || camera.focalLength <= 0) {
+    error = "the camera needs a non-negative aperture and a positive focal "
+            "length";
+    return false;
+  }
+  return true;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+RenderServer::RenderServer(Settings settings, ConfigReader readConfig,
+                           int capacity)
+    : m_settings(std::move(settings)), m_readConfig(std::move(readConfig)),
+      m_capacity(std::max(capacity, 1)) {
+  QObject::connect(&m_server, &QTcpServer::newConnection, [this]() {
+    while (QTcpSocket *socket = m_server.nextPendingConnection()) {
+      QObject::connect(socket, &QTcpSocket::disconnected, socket,
+                       &QObject::deleteLater);
+      auto received = std::make_shared<QByteArray>();
+      QObject::connect(socket, &QTcpSocket::readyRead, [this, socket,
+                                                        received]() {
+        received->append(socket->readAll());
+        int end = received->indexOf("\r\n\r\n");
+        if (end < 0 && received->size() <= MAX_HEADER_SIZE) {
+          return;
+        }
+        // Only one request is answered per connection
+        QObject::disconnect(socket, &QTcpSocket::readyRead, nullptr, nullptr);
+        serve(socket, end < 0 ? QByteArray() : received->left(end));
+      });
+    }
+  });
+}
+
+bool RenderServer::listen(quint16 port) {
+  if (!m_server.listen(QHostAddress::LocalHost, port)) {
+    std::cout << "could not listen on port " << port << ": "
+              << m_server.errorString().toStdString() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+quint16 RenderServer::port() const { return m_server.serverPort(); }
+
+void RenderServer::serve(QTcpSocket *socket, const QByteArray &header) {
+  Reply reply;
+  QList<QByteArray> requestLine =
+      header.left(header.indexOf("\r\n")).split(' ');
+  if (header.isEmpty()) {
+    reply = errorReply(431, "request header too large");
+  } else if (requestLine.size() != 3) {
+    reply = errorReply(400, "malformed request line");
+  } else if (requestLine[0] != "GET") {
+    reply = errorReply(405, "only GET is supported");
+  } else {
+    QUrl url(QString::fromUtf8(requestLine[1]));
+    if (url.path() != "/render") {
+      reply = errorReply(404, "unknown path " + url.path().toStdString());
+    } else {
+      QUrlQuery query(url);
+      try {
+        reply = render([&](const QString &key, const QVariant &defaultValue) {
+          if (query.hasQueryItem(key)) {
+            return QVariant(query.queryItemValue(key, QUrl::FullyDecoded));
+          }
+          return m_settings(key, defaultValue);
+        });
+      } catch (const std::bad_alloc &) {
+        // Within the pixel limit, but still more than this machine can hold
+        reply = errorReply(500, "out of memory");
+      }
+    }
+  }
+
+  QByteArray response = "HTTP/1.1 " + QByteArray::number(reply.status) +
+                        " " + reasonPhrase(reply.status) + "\r\n";
+  response += "Content-Type: " + reply.contentType + "\r\n";
+  response += "Content-Length: " + QByteArray::number(reply.body.size()) +
+              "\r\n";
+  for (const auto &[name, value] : reply.headers) {
+    response += name + ": " + value + "\r\n";
+  }
+  response += "Connection: close\r\n\r\n";
+  socket->write(response);
+  socket->write(reply.body);
+  // Closes once everything is written
+  socket->disconnectFromHost();
+}
+
+RenderServer::WarmScene *RenderServer::findScene(const std::string &key) {
+  auto it = m_index.find(key);
+  if (it == m_index.end()) {
+    return nullptr;
+  }
+  m_scenes.splice(m_scenes.begin(), m_scenes, it->second);
+  return &m_scenes.front();
+}
+
+RenderServer::WarmScene *RenderServer::loadScene(const std::string &key,
+                                                 const std::string &path) {
+  m_scenes.emplace_front();
+  WarmScene &warm = m_scenes.front();
+  if (!warm.animation.load(path)) {
+    m_scenes.pop_front();
+    return nullptr;
+  }
+  warm.key = key;
+  warm.path = path;
+  m_index[key] = m_scenes.begin();
+  while (static_cast<int>(m_scenes.size()) > m_capacity) {
+    const WarmScene &evicted = m_scenes.back();
+    auto version = m_versions.find(evicted.path);
+    if (version != m_versions.end() && version->second.key == evicted.key) {
+      m_versions.erase(version);
+    }
+    m_index.erase(evicted.key);
+    m_scenes.pop_back();
+  }
+  return &warm;
+}
+
+bool RenderServer::sceneKey(const std::string &path, std::string &absolutePath,
+                            std::string &key) {
+  QFileInfo info(QString::fromStdString(path));
+  if (!info.exists()) {
+    return false;
+  }
+  absolutePath = info.absoluteFilePath().toStdString();
+  qint64 size = info.size();
+  qint64 modified = info.lastModified().toMSecsSinceEpoch();
+  auto version = m_versions.find(absolutePath);
+  if (version != m_versions.end() && version->second.size == size &&
+      version->second.modified == modified) {
+    key = version->second.key;
+    return true;
+  }
+
+  // Scenes resolve texture paths against their own location, so the same
+  // contents elsewhere are a different scene
+  QFile file(QString::fromStdString(absolutePath));
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  if (!file.open(QFile::ReadOnly) || !hash.addData(&file)) {
+    return false;
+  }
+  key = absolutePath + ":" + hash.result().toHex().toStdString();
+  m_versions[absolutePath] = FileVersion{size, modified, key};
+  return true;
+}
+
+RenderServer::Reply RenderServer::render(const Settings &request) {
+  auto start = std::chrono::steady_clock::now();
+  std::string path = request("IO/scene", {}).toString().toStdString();
+  int width = request("Canvas/width", {}).toInt();
+  int height = request("Canvas/height", {}).toInt();
+  if (path.empty() || width <= 0 || height <= 0) {
+    return errorReply(400, "a render needs IO/scene, and a positive "
+                           "Canvas/width and Canvas/height");
+  }
+  // One oversized request must not take the server down with it
+  qint64 maxPixels =
+      m_settings("Server/max-pixels", DEFAULT_MAX_PIXELS).toLongLong();
+  if (qint64(width) * height > maxPixels) {
+    return errorReply(400, "a render can have at most " +
+                               std::to_string(maxPixels) + " pixels");
+  }
+
+  std::string absolutePath;
+  std::string key;
+  if (!sceneKey(path, absolutePath, key)) {
+    return errorReply(404, "could not open " + path);
+  }
+  WarmScene *warm = findScene(key);
+  bool hit = warm != nullptr;
+  if (!hit) {
+    warm = loadScene(key, absolutePath);
+    if (!warm) {
+      return errorReply(400, "could not load " + path);
+    }
+  }
+
+  RenderData renderData;
+  warm->animation.evaluate(request("Animation/time", 0).toFloat(), renderData);
+  std::string error;
+  if (!overrideCamera(request, renderData.cameraData, error)) {
+    return errorReply(400, error);
+  }
+  if (!warm->scene) {
+    // Like the lights, the BVH's threshold is fixed when the scene's built
+    float lightCutoff =
+        m_settings("Light/cutoff", LightIndex::DEFAULT_CUTOFF).toFloat();
+    float bvhRebuildThreshold = m_settings("Acceleration/rebuild-threshold",
+                                           BVH::DEFAULT_REBUILD_THRESHOLD)
+                                    .toFloat();
+    warm->scene = std::make_unique<RayTraceScene>(
+        width, height, renderData, lightCutoff, bvhRebuildThreshold);
+  } else {
+    warm->scene->update(renderData, width, height);
+  }
+  double loadSeconds = secondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  RayTracer::Config config = m_readConfig(request);
+  RayTracer raytracer(config);
+  FrameBuffer frame(width, height, config.enableDenoise);
+  if (config.enableProgressive) {
+    AccumulationBuffer buffer(width, height, config.enableDenoise);
+    raytracer.renderProgressive(buffer, *warm->scene, [](int, int) {});
+    buffer.resolve(frame);
+    raytracer.denoise(frame);
+  } else {
+    raytracer.render(frame, *warm->scene);
+  }
+  QImage image(width, height, QImage::Format_RGBX8888);
+  raytracer.resolve(frame, reinterpret_cast<RGBA *>(image.bits()));
+  double renderSeconds = secondsSince(start);
+
+  Reply reply{200, "image/png", QByteArray(), {}};
+  QBuffer png(&reply.body);
+  png.open(QIODevice::WriteOnly);
+  image.save(&png, "PNG");
+  reply.headers.emplace_back("X-Scene-Cache", hit ? "hit" : "miss");
+  reply.headers.emplace_back("X-Load-Seconds", QByteArray::number(loadSeconds));
+  reply.headers.emplace_back("X-Render-Seconds",
+                             QByteArray::number(renderSeconds));
+  std::cout << "Rendered " << path << " at " << width << "x" << height << " ("
+            << (hit ? "cached" : "loaded") << " in " << loadSeconds
+            << " s, rendered in " << renderSeconds << " s)" << std::endl;
+  return reply;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "raytracer/raytracer.h"
+#include "raytracer/raytracescene.h"
+#include "utils/sceneparser.h"
+#include <QByteArray>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QVariant>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A resident renderer that takes render requests over HTTP on localhost, and
+// keeps the scenes it has rendered loaded for the next requests.
+
+// GET /render?<key>=<value>&... answers with a PNG. The keys are those of the
+// config file, such as IO/scene, Canvas/width or Feature/shadows, and
+// override the server's own config for the one request. A request can also
+// replace the scene's camera with Camera/pos, Camera/look, Camera/focus and
+// Camera/up, each given as "x,y,z", Camera/heightangle in degrees,
+// Camera/aperture and Camera/focallength; a new position keeps the camera's
+// look direction unless a focus is given too. Animation/time, in seconds,
+// poses an animated scene. For example, a 640x480 render of a.xml:
+//
+//   GET /render?IO/scene=scenes/a.xml&Canvas/width=640&Canvas/height=480
+//
+// Scenes are cached by their path and a hash of their file's contents, so an
+// edited file is loaded afresh. The hash is only recomputed when the file's
+// size or modification time changes. A cached scene keeps its parsed scene
+// graph, primitives, BVH and light structures, and through them its
+// textures, so a request for it only has to pose the camera and whatever
+// moved before it renders. The least recently used scene is dropped, with
+// the textures only it used, once more are cached than the server's
+// capacity. Requests are rendered one at a time, each on every core, and
+// none may have more pixels than Server/max-pixels.
+
+class RenderServer {
+public:
+  // Looks a config key up, returning defaultValue if it isn't set
+  using Settings =
+      std::function<QVariant(const QString &key, const QVariant &defaultValue)>;
+  // Makes the ray tracer's configuration from a request's settings
+  using ConfigReader = std::function<RayTracer::Config(const Settings &)>;
+
+  // What a request is answered with
+  struct Reply {
+    int status;
+    QByteArray contentType;
+    QByteArray body;
+    std::vector<std::pair<QByteArray, QByteArray>> headers;
+  };
+
+  static constexpr qint64 DEFAULT_MAX_PIXELS = 16 << 20;
+
+  // Requests fall back on settings for keys they don't set, and keep up to
+  // capacity scenes loaded.
+  RenderServer(Settings settings, ConfigReader readConfig, int capacity);
+
+  // Starts serving on localhost at port, or at a free port if it's 0.
+  // Returns false if the port can't be listened on.
+  bool listen(quint16 port);
+
+  quint16 port() const;
+
+  // Renders the request with the given settings.
+  Reply render(const Settings &request);
+
+private:
+  struct WarmScene {
+    std::string key;
+    std::string path; // Absolute
+    SceneAnimation animation;
+    std::unique_ptr<RayTraceScene> scene;
+  };
+
+  // The version of a scene file that was last hashed
+  struct FileVersion {
+    qint64 size;
+    qint64 modified; // Milliseconds since the epoch
+    std::string key;
+  };
+
+  // Answers the HTTP request whose request line and headers are header.
+  void serve(QTcpSocket *socket, const QByteArray &header);
+
+  // Finds the absolute path of the scene file at path, and its cache key:
+  // that path and a hash of the file's contents. Returns false if the file
+  // can't be read.
+  bool sceneKey(const std::string &path, std::string &absolutePath,
+                std::string &key);
+
+  // Returns the cached scene for key, now the most recently used, or nullptr
+  // if it isn't cached.
+  WarmScene *findScene(const std::string &key);
+
+  // Loads the scene file at path and caches it for key, dropping the least
+  // recently used scene if the cache is full. Returns nullptr if it can't be
+  // loaded.
+  WarmScene *loadScene(const std::string &key, const std::string &path);
+
+  Settings m_settings;
+  ConfigReader m_readConfig;
+  int m_capacity;
+  QTcpServer m_server;
+  // Most recently used first
+  std::list<WarmScene> m_scenes;
+  std::unordered_map<std::string, std::list<WarmScene>::iterator> m_index;
+  // By absolute path, for the files of cached scenes
+  std::unordered_map<std::string, FileVersion> m_versions;
+};
@@ -0,0 +1,68 @@
+#include "bc1.h"
+
+#include <algorithm>
+
+namespace {
+
+std::uint16_t toRGB565(int r, int g, int b) {
+  return static_cast<std::uint16_t>(((r * 31 + 127) / 255) << 11 |
+                                    ((g * 63 + 127) / 255) << 5 |
+                                    ((b * 31 + 127) / 255));
+}
+
+} // namespace
+
+BC1Block encodeBC1(const RGBA texels[16]) {
+  // Use the corners of the block's color bounding box, inset slightly so
+  // outliers don't stretch the palette, as the endpoints
+  int min[3] = {255, 255, 255};
+  int max[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    const int channels[3] = {texels[i].r, texels[i].g, texels[i].b};
+    for (int c = 0; c < 3; c++) {
+      min[c] = std::min(min[c], channels[c]);
+      max[c] = std::max(max[c], channels[c]);
+    }
+  }
+  for (int c = 0; c < 3; c++) {
+    int inset = (max[c] - min[c]) / 16;
+    min[c] += inset;
+    max[c] -= inset;
+  }
+
+  BC1Block block;
+  block.color0 = toRGB565(max[0], max[1], max[2]);
+  block.color1 = toRGB565(min[0], min[1], min[2]);
+  block.indices = 0;
+  if (block.color0 == block.color1) {
+    // A flat block; every texel uses color0
+    return block;
+  }
+  // Keep color0 > color1, which selects the four-color palette in BC1
+  if (block.color0 < block.color1) {
+    std::swap(block.color0, block.color1);
+  }
+
+  RGBA palette[4];
+  for (int i = 0; i < 4; i++) {
+    BC1Block single = block;
+    single.indices = i;
+    palette[i] = decodeBC1(single, 0, 0);
+  }
+  for (int i = 0; i < 16; i++) {
+    int best = 0;
+    int bestDistance = 1 << 30;
+    for (int p = 0; p < 4; p++) {
+      int dr = texels[i].r - palette[p].r;
+      int dg = texels[i].g - palette[p].g;
+      int db = texels[i].b - palette[p].b;
+      int distance = dr * dr + dg * dg + db * db;
+      if (distance < bestDistance) {
+        bestDistance = distance;
+        best = p;
+      }
+    }
+    block.indices |= static_cast<std::uint32_t>(best) << (2 * i);
+  }
+  return block;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "utils/rgba.h"
+#include <cstdint>
+
+// A BC1-style compressed block: 4x4 opaque texels stored as two RGB565
+// endpoint colors and a 2-bit index per texel into a four-color palette
+// interpolated between them. 8 bytes instead of 64, with random access to
+// any texel.
+
+struct BC1Block {
+  std::uint16_t color0;
+  std::uint16_t color1;
+  std::uint32_t indices; // Texel (x, y) uses bits 2 * (4 * y + x) and up
+};
+
+// Compresses 16 texels, given row-major, into a block.
+BC1Block encodeBC1(const RGBA texels[16]);
+
+// Decodes texel (x, y) of a block.
+inline RGBA decodeBC1(const BC1Block &block, int x, int y) {
+  auto expand = [](std::uint16_t c, int shift, int bits) {
+    int value = (c >> shift) & ((1 << bits) - 1);
+    return (value << (8 - bits)) | (value >> (2 * bits - 8));
+  };
+  int r0 = expand(block.color0, 11, 5);
+  int g0 = expand(block.color0, 5, 6);
+  int b0 = expand(block.color0, 0, 5);
+  int r1 = expand(block.color1, 11, 5);
+  int g1 = expand(block.color1, 5, 6);
+  int b1 = expand(block.color1, 0, 5);
+  // Indices 0 and 1 pick an endpoint; 2 and 3 lie a third and two thirds of
+  // the way from color0 to color1
+  static constexpr int weights[4] = {0, 3, 1, 2};
+  int w = weights[(block.indices >> (2 * (4 * y + x))) & 3];
+  return RGBA{static_cast<std::uint8_t>((r0 * (3 - w) + r1 * w) / 3),
+              static_cast<std::uint8_t>((g0 * (3 - w) + g1 * w) / 3),
+              static_cast<std::uint8_t>((b0 * (3 - w) + b1 * w) / 3), 255};
+}
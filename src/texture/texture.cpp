@@ -0,0 +1,150 @@
+#include "texture.h"
+#include "tiledtexture.h"
+
+#include <cstring>
+
+namespace {
+
+// Box-filters src down to half its size into dst. Odd dimensions reuse the
+// last row or column rather than reading past the edge.
+void downsample(const RGBA *src, int srcWidth, int srcHeight, RGBA *dst,
+                int dstWidth, int dstHeight) {
+  for (int y = 0; y < dstHeight; y++) {
+    int y0 = std::min(2 * y, srcHeight - 1);
+    int y1 = std::min(2 * y + 1, srcHeight - 1);
+    for (int x = 0; x < dstWidth; x++) {
+      int x0 = std::min(2 * x, srcWidth - 1);
+      int x1 = std::min(2 * x + 1, srcWidth - 1);
+      const RGBA &a = src[y0 * srcWidth + x0];
+      const RGBA &b = src[y0 * srcWidth + x1];
+      const RGBA &c = src[y1 * srcWidth + x0];
+      const RGBA &d = src[y1 * srcWidth + x1];
+      dst[y * dstWidth + x] = RGBA{
+          static_cast<std::uint8_t>((a.r + b.r + c.r + d.r + 2) / 4),
+          static_cast<std::uint8_t>((a.g + b.g + c.g + d.g + 2) / 4),
+          static_cast<std::uint8_t>((a.b + b.b + c.b + d.b + 2) / 4),
+          static_cast<std::uint8_t>((a.a + b.a + c.a + d.a + 2) / 4)};
+    }
+  }
+}
+
+} // namespace
+
+Texture::Texture(const QImage &image) {
+  // RGBX8888 matches the byte layout of RGBA, with alpha forced opaque
+  QImage converted = image.convertToFormat(QImage::Format_RGBX8888);
+
+  // Lay out every level of the pyramid in one allocation
+  std::vector<std::size_t> offsets;
+  std::size_t total = 0;
+  int width = converted.width();
+  int height = converted.height();
+  while (true) {
+    offsets.push_back(total);
+    m_levels.push_back(Level{width, height, nullptr});
+    total += static_cast<std::size_t>(width) * height;
+    if (width == 1 && height == 1) {
+      break;
+    }
+    width = std::max(1, width / 2);
+    height = std::max(1, height / 2);
+  }
+  m_texels.resize(total);
+  for (std::size_t i = 0; i < m_levels.size(); i++) {
+    m_levels[i].texels = m_texels.data() + offsets[i];
+  }
+
+  RGBA *base = m_texels.data();
+  for (int y = 0; y < m_levels[0].height; y++) {
+    std::memcpy(base + static_cast<std::size_t>(y) * m_levels[0].width,
+                converted.constScanLine(y), m_levels[0].width * sizeof(RGBA));
+  }
+  for (std::size_t i = 1; i < m_levels.size(); i++) {
+    const Level &src = m_levels[i - 1];
+    const Level &dst = m_levels[i];
+    downsample(src.texels, src.width, src.height,
+               m_texels.data() + offsets[i], dst.width, dst.height);
+  }
+}
+
+Texture::Texture(std::shared_ptr<const TiledTexture> tiles)
+    : m_tiles(std::move(tiles)) {
+  for (int i = 0; i < m_tiles->levelCount(); i++) {
+    m_levels.push_back(
+        Level{m_tiles->levelWidth(i), m_tiles->levelHeight(i), nullptr});
+  }
+}
+
+Texture::Texture(std::vector<Level> levels, std::shared_ptr<const void> storage)
+    : m_levels(std::move(levels)), m_storage(std::move(storage)) {}
+
+std::shared_ptr<const Texture> Texture::compress(const Texture &source) {
+  std::shared_ptr<Texture> texture(new Texture());
+  std::vector<std::size_t> offsets;
+  std::size_t total = 0;
+  for (const Level &level : source.m_levels) {
+    int blocksPerRow = (level.width + 3) / 4;
+    int blockRows = (level.height + 3) / 4;
+    offsets.push_back(total);
+    texture->m_levels.push_back(
+        Level{level.width, level.height, nullptr, nullptr, blocksPerRow});
+    total += static_cast<std::size_t>(blocksPerRow) * blockRows;
+  }
+  texture->m_blocks.resize(total);
+
+  for (int i = 0; i < source.levelCount(); i++) {
+    Level &level = texture->m_levels[i];
+    BC1Block *blocks = texture->m_blocks.data() + offsets[i];
+    level.blocks = blocks;
+    int blockRows = (level.height + 3) / 4;
+    RGBA texels[16];
+    for (int by = 0; by < blockRows; by++) {
+      for (int bx = 0; bx < level.blocksPerRow; bx++) {
+        // Blocks overhanging the edge repeat the last row and column
+        for (int y = 0; y < 4; y++) {
+          int sourceY = std::min(4 * by + y, level.height - 1);
+          for (int x = 0; x < 4; x++) {
+            int sourceX = std::min(4 * bx + x, level.width - 1);
+            glm::vec4 color = source.fetch(i, sourceX, sourceY) * 255.f;
+            texels[4 * y + x] = RGBA{static_cast<std::uint8_t>(color.r + 0.5f),
+                                     static_cast<std::uint8_t>(color.g + 0.5f),
+                                     static_cast<std::uint8_t>(color.b + 0.5f),
+                                     255};
+          }
+        }
+        blocks[by * level.blocksPerRow + bx] = encodeBC1(texels);
+      }
+    }
+  }
+  return texture;
+}
+
+std::size_t Texture::memoryUsage() const {
+  return m_texels.size() * sizeof(RGBA) + m_blocks.size() * sizeof(BC1Block);
+}
+
+RGBA Texture::fetchCompressed(int level, int x, int y) const {
+  const Level &l = m_levels[level];
+  return decodeBC1(l.blocks[(y >> 2) * l.blocksPerRow + (x >> 2)], x & 3,
+                   y & 3);
+}
+
+RGBA Texture::fetchTiled(int level, int x, int y) const {
+  return m_tiles->texel(level, x, y);
+}
+
+void Texture::sample(const glm::vec2 *st, glm::vec4 *colors,
+                     std::size_t count, Filter filter, int level) const {
+  switch (filter) {
+  case Filter::Nearest:
+    for (std::size_t i = 0; i < count; i++) {
+      colors[i] = sampleNearest(st[i], level);
+    }
+    break;
+  case Filter::Bilinear:
+    for (std::size_t i = 0; i < count; i++) {
+      colors[i] = sampleBilinear(st[i], level);
+    }
+    break;
+  }
+}
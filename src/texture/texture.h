@@ -0,0 +1,169 @@
+#pragma once
+
+#include "bc1.h"
+#include "utils/rgba.h"
+#include <QImage>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+class TiledTexture;
+
+// An immutable, mipmapped texture whose texels are stored contiguously as
+// RGBA8, row-major from the top-left corner of each level, either in memory
+// or in the tiles of a TiledTexture.
+
+// Samplers take texture-space coordinates: (0, 0) is the top-left corner of
+// the image and (1, 1) the bottom-right. Coordinates outside that range wrap,
+// which is how texture repeats are applied.
+
+class Texture {
+public:
+  enum class Filter { Nearest, Bilinear };
+
+  // One level of the mip pyramid. Level 0 is the full-resolution image and
+  // each following level halves both dimensions, down to 1x1. Compressed
+  // levels store blocks instead of texels; both are null for textures whose
+  // texels are paged in from a tiled texture file.
+  struct Level {
+    int width;
+    int height;
+    const RGBA *texels;
+    const BC1Block *blocks = nullptr;
+    int blocksPerRow = 0;
+  };
+
+  explicit Texture(const QImage &image);
+
+  // Creates a texture whose texels are loaded on demand from tiles.
+  explicit Texture(std::shared_ptr<const TiledTexture> tiles);
+
+  // Wraps levels whose texels live in memory owned elsewhere, such as a
+  // mapped file, which storage keeps alive.
+  Texture(std::vector<Level> levels, std::shared_ptr<const void> storage);
+
+  // Levels point into the texture's own storage, so textures aren't copied
+  Texture(const Texture &) = delete;
+  Texture &operator=(const Texture &) = delete;
+
+  // Returns a block-compressed copy of source, about 8x smaller, whose
+  // texels are decoded as they are sampled.
+  static std::shared_ptr<const Texture> compress(const Texture &source);
+
+  // Returns the bytes of texel data held in memory by this texture.
+  std::size_t memoryUsage() const;
+
+  int width() const { return m_levels[0].width; }
+  int height() const { return m_levels[0].height; }
+  int levelCount() const { return static_cast<int>(m_levels.size()); }
+  const Level &level(int index) const { return m_levels[index]; }
+
+  // Returns texel (x, y) of a level, decoding or paging it in as needed.
+  RGBA texel(int level, int x, int y) const {
+    const Level &l = m_levels[level];
+    if (l.texels) {
+      return l.texels[y * l.width + x];
+    }
+    if (l.blocks) {
+      return fetchCompressed(level, x, y);
+    }
+    return fetchTiled(level, x, y);
+  }
+
+  // Returns the texel containing st, as a color in [0, 1].
+  glm::vec4 sampleNearest(glm::vec2 st, int level = 0) const {
+    const Level &l = m_levels[level];
+    int x = static_cast<int>(wrap(st.x) * l.width);
+    int y = static_cast<int>(wrap(st.y) * l.height);
+    // Rounding can land exactly on the far edge
+    x = x < l.width ? x : l.width - 1;
+    y = y < l.height ? y : l.height - 1;
+    return fetch(level, x, y);
+  }
+
+  // Returns the bilinear blend of the four texels around st.
+  glm::vec4 sampleBilinear(glm::vec2 st, int level = 0) const {
+    const Level &l = m_levels[level];
+    float x = wrap(st.x) * l.width - 0.5f;
+    float y = wrap(st.y) * l.height - 0.5f;
+    int x0 = floorToInt(x);
+    int y0 = floorToInt(y);
+    float fx = x - x0;
+    float fy = y - y0;
+    int x1 = x0 + 1;
+    int y1 = y0 + 1;
+    // x0 and y0 are at least -1 and x1 and y1 at most the size, so a single
+    // conditional wraps them
+    x0 = x0 < 0 ? x0 + l.width : x0;
+    y0 = y0 < 0 ? y0 + l.height : y0;
+    x1 = x1 >= l.width ? x1 - l.width : x1;
+    y1 = y1 >= l.height ? y1 - l.height : y1;
+    glm::vec4 top = glm::mix(fetch(level, x0, y0), fetch(level, x1, y0), fx);
+    glm::vec4 bottom =
+        glm::mix(fetch(level, x0, y1), fetch(level, x1, y1), fx);
+    return glm::mix(top, bottom, fy);
+  }
+
+  // Filters the texture over the footprint spanned by the texture-space
+  // offsets dstdx and dstdy, blending bilinear samples from the two mip
+  // levels closest to the footprint's size.
+  glm::vec4 sampleTrilinear(glm::vec2 st, glm::vec2 dstdx,
+                            glm::vec2 dstdy) const {
+    float lod = levelOfDetail(dstdx, dstdy);
+    int level = static_cast<int>(lod);
+    if (level >= levelCount() - 1) {
+      return sampleBilinear(st, levelCount() - 1);
+    }
+    return glm::mix(sampleBilinear(st, level), sampleBilinear(st, level + 1),
+                    lod - level);
+  }
+
+  // Returns the fractional mip level whose texels best match a footprint
+  // spanned by dstdx and dstdy.
+  float levelOfDetail(glm::vec2 dstdx, glm::vec2 dstdy) const {
+    glm::vec2 size(width(), height());
+    glm::vec2 dx = dstdx * size;
+    glm::vec2 dy = dstdy * size;
+    float footprint = std::max(glm::dot(dx, dx), glm::dot(dy, dy));
+    // log2 of the footprint's width, via its squared length
+    float lod = 0.5f * std::log2(std::max(footprint, 1e-12f));
+    return std::clamp(lod, 0.f, static_cast<float>(levelCount() - 1));
+  }
+
+  // Samples count coordinates from st into colors with the given filter.
+  void sample(const glm::vec2 *st, glm::vec4 *colors, std::size_t count,
+              Filter filter, int level = 0) const;
+
+private:
+  Texture() = default;
+
+  // std::floor is a library call unless the target has SSE4.1, which is far
+  // too slow for a per-sample operation
+  static int floorToInt(float x) {
+    int i = static_cast<int>(x);
+    return x < i ? i - 1 : i;
+  }
+
+  // Returns the fractional part of s, wrapping it into [0, 1)
+  static float wrap(float s) { return s - floorToInt(s); }
+
+  glm::vec4 fetch(int level, int x, int y) const {
+    RGBA t = texel(level, x, y);
+    return glm::vec4(t.r, t.g, t.b, t.a) * (1.f / 255.f);
+  }
+
+  // Kept out of line so the uncompressed path above stays small enough to
+  // inline into the samplers
+  RGBA fetchCompressed(int level, int x, int y) const;
+  RGBA fetchTiled(int level, int x, int y) const;
+
+  std::vector<Level> m_levels;
+  std::vector<RGBA> m_texels;
+  std::vector<BC1Block> m_blocks;
+  std::shared_ptr<const void> m_storage;
+  // Set instead of m_texels when the texels live in a tiled texture file
+  std::shared_ptr<const TiledTexture> m_tiles;
+};
@@ -0,0 +1,177 @@
+#include "texturecache.h"
+#include "texturefile.h"
+#include "tiledtexture.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QtConcurrent/QtConcurrent>
+#include <filesystem>
+#include <iostream>
+
+TextureCache &TextureCache::instance() {
+  static TextureCache cache;
+  return cache;
+}
+
+std::string TextureCache::canonicalPath(const std::string &filename) {
+  std::error_code error;
+  std::filesystem::path path =
+      std::filesystem::weakly_canonical(filename, error);
+  if (error) {
+    return filename;
+  }
+  return path.string();
+}
+
+std::string TextureCache::key(const SceneFileMap &map) const {
+  std::string key = canonicalPath(map.filename);
+  TextureFile::Source source;
+  if (TextureFile::describe(key, source)) {
+    key += ":" + std::to_string(source.size) + ":" +
+           std::to_string(source.modified);
+  }
+  return isCompressed(map) ? key + "#bc1" : key;
+}
+
+bool TextureCache::isCompressed(const SceneFileMap &map) const {
+  return (m_compressAll || map.compress) &&
+         !TiledTexture::isTiledTextureFile(map.filename);
+}
+
+std::shared_ptr<const Texture>
+TextureCache::decode(const SceneFileMap &map) const {
+  std::string path = canonicalPath(map.filename);
+  if (TiledTexture::isTiledTextureFile(path)) {
+    // Only the headers are read now; tiles are paged in while rendering
+    std::shared_ptr<TiledTexture> tiles = TiledTexture::open(path);
+    if (!tiles) {
+      std::cout << "Failed to load texture: " << path << std::endl;
+      return nullptr;
+    }
+    return std::make_shared<const Texture>(tiles);
+  }
+
+  std::shared_ptr<const Texture> texture;
+  TextureFile::Source source;
+  bool precompiled = m_precompiled && TextureFile::describe(path, source);
+  if (precompiled) {
+    texture = TextureFile::load(precompiledPath(path), source);
+  }
+  if (!texture) {
+    QImage image(QString::fromStdString(path));
+    if (image.isNull()) {
+      std::cout << "Failed to load texture: " << path << std::endl;
+      return nullptr;
+    }
+    texture = std::make_shared<const Texture>(image);
+    if (precompiled &&
+        !TextureFile::write(*texture, precompiledPath(path), source)) {
+      // Rendering can go on without the cache file; it is rebuilt next time
+      std::cout << "Could not write precompiled texture: "
+                << precompiledPath(path) << std::endl;
+    }
+  }
+  if (isCompressed(map)) {
+    return Texture::compress(*texture);
+  }
+  return texture;
+}
+
+std::string TextureCache::Textures::name(const SceneFileMap &map) {
+  return map.compress ? map.filename + "#bc1" : map.filename;
+}
+
+std::shared_ptr<const Texture>
+TextureCache::Textures::find(const SceneFileMap &map) const {
+  auto it = m_textures.find(name(map));
+  return it == m_textures.end() ? nullptr : it->second;
+}
+
+std::shared_ptr<const Texture> TextureCache::get(const SceneFileMap &map) {
+  return preload({map}).find(map);
+}
+
+TextureCache::Textures
+TextureCache::preload(const std::vector<SceneFileMap> &maps) {
+  // Scenes share a few textures among many shapes, so only the distinct
+  // names are resolved, outside the lock as that touches the filesystem
+  Textures textures;
+  std::vector<const SceneFileMap *> distinct;
+  for (const SceneFileMap &map : maps) {
+    if (textures.m_textures.try_emplace(Textures::name(map)).second) {
+      distinct.push_back(&map);
+    }
+  }
+  std::vector<std::string> keys;
+  keys.reserve(distinct.size());
+  for (const SceneFileMap *map : distinct) {
+    keys.push_back(key(*map));
+  }
+
+  // Different names of the same file share its texture
+  std::unordered_map<std::string, std::shared_ptr<const Texture>> found;
+  std::vector<std::pair<std::string, const SceneFileMap *>> missing;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // Forget the textures nothing uses any more, and old versions of files
+    std::erase_if(m_textures,
+                  [](const auto &entry) { return entry.second.expired(); });
+    for (std::size_t i = 0; i < distinct.size(); i++) {
+      if (found.count(keys[i])) {
+        continue;
+      }
+      auto it = m_textures.find(keys[i]);
+      if (it != m_textures.end()) {
+        found.emplace(keys[i], it->second.lock());
+      } else {
+        found.emplace(keys[i], nullptr);
+        missing.emplace_back(keys[i], distinct[i]);
+      }
+    }
+  }
+  // If another thread raced us to a texture, its copy is kept
+  QtConcurrent::blockingMap(
+      missing,
+      [&](const std::pair<std::string, const SceneFileMap *> &entry) {
+        std::shared_ptr<const Texture> texture = decode(*entry.second);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::weak_ptr<const Texture> &cached = m_textures[entry.first];
+        if (std::shared_ptr<const Texture> raced = cached.lock()) {
+          texture = raced;
+        } else if (texture) {
+          cached = texture;
+        }
+        found[entry.first] = texture;
+      });
+
+  for (std::size_t i = 0; i < distinct.size(); i++) {
+    textures.m_textures[Textures::name(*distinct[i])] = found[keys[i]];
+  }
+  return textures;
+}
+
+void TextureCache::clear() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_textures.clear();
+}
+
+void TextureCache::setPrecompiled(bool enabled, const std::string &directory) {
+  m_precompiled = enabled;
+  m_precompiledDirectory = directory;
+  if (enabled && !directory.empty()) {
+    QDir().mkpath(QString::fromStdString(directory));
+  }
+}
+
+std::string TextureCache::precompiledPath(const std::string &path) const {
+  if (m_precompiledDirectory.empty()) {
+    return path + ".rtc";
+  }
+  // Name files in a shared directory after a hash of the full source path
+  QByteArray hash = QCryptographicHash::hash(
+      QByteArray::fromStdString(path), QCryptographicHash::Sha1);
+  std::filesystem::path directory(m_precompiledDirectory);
+  return (directory / (hash.toHex().toStdString() + ".rtc")).string();
+}
+
+void TextureCache::setCompressAll(bool enabled) { m_compressAll = enabled; }
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "texture.h"
+#include "utils/scenedata.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A process-wide cache of decoded textures.
+
+// Textures are keyed by canonical file path, so every primitive that
+// references the same image file shares one decoded, immutable copy. The key
+// also holds the file's size and modification time, so an edited image is
+// decoded afresh. The cache only holds textures weakly: a texture is freed
+// along with the last primitive using it, so a long-running process doesn't
+// keep the textures of every scene it ever loaded.
+
+class TextureCache {
+public:
+  // The textures of a set of maps, found again by the filename each map gives
+  // without going back to the filesystem.
+  class Textures {
+  public:
+    // Returns the texture for map, or nullptr if it wasn't among the maps or
+    // could not be loaded.
+    std::shared_ptr<const Texture> find(const SceneFileMap &map) const;
+
+  private:
+    friend class TextureCache;
+    static std::string name(const SceneFileMap &map);
+
+    std::unordered_map<std::string, std::shared_ptr<const Texture>> m_textures;
+  };
+
+  static TextureCache &instance();
+
+  // Returns the shared texture for a texture map, decoding it on first use.
+  // Returns nullptr if the file could not be loaded.
+  std::shared_ptr<const Texture> get(const SceneFileMap &map);
+
+  // Returns the textures of maps, decoding those not cached yet in parallel.
+  // Each distinct filename is resolved once, however many maps name it.
+  Textures preload(const std::vector<SceneFileMap> &maps);
+
+  // Forgets every texture; those still held by primitives survive, but are
+  // no longer shared with later loads.
+  void clear();
+
+  // Configures precompiled texture files. When enabled, decoded images are
+  // written to a .rtc file next to their source, or into directory if it is
+  // not empty, and later loads map that file instead of decoding the image.
+  void setPrecompiled(bool enabled, const std::string &directory);
+
+  // Returns where the precompiled file for the image at path is stored.
+  std::string precompiledPath(const std::string &path) const;
+
+  // Block-compresses every texture, not just those whose map asks for it.
+  void setCompressAll(bool enabled);
+
+private:
+  TextureCache() = default;
+
+  static std::string canonicalPath(const std::string &filename);
+  // Textures are keyed by canonical path, the file's size and modification
+  // time, and whether they are compressed
+  std::string key(const SceneFileMap &map) const;
+  bool isCompressed(const SceneFileMap &map) const;
+  std::shared_ptr<const Texture> decode(const SceneFileMap &map) const;
+
+  std::mutex m_mutex;
+  std::unordered_map<std::string, std::weak_ptr<const Texture>> m_textures;
+
+  bool m_compressAll = false;
+  bool m_precompiled = false;
+  std::string m_precompiledDirectory;
+};
@@ -0,0 +1,119 @@
+#include "texturefile.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+constexpr char MAGIC[4] = {'R', 'T', 'C', 'F'};
+constexpr quint32 VERSION = 1;
+
+} // namespace
+
+bool TextureFile::describe(const std::string &path, Source &source) {
+  QFileInfo info(QString::fromStdString(path));
+  if (!info.exists()) {
+    return false;
+  }
+  source.path = path;
+  source.size = info.size();
+  source.modified = info.lastModified().toMSecsSinceEpoch();
+  return true;
+}
+
+std::shared_ptr<const Texture> TextureFile::load(const std::string &filename,
+                                                 const Source &source) {
+  auto file = std::make_shared<QFile>(QString::fromStdString(filename));
+  if (!file->open(QFile::ReadOnly)) {
+    return nullptr;
+  }
+  qint64 fileSize = file->size();
+  Header header;
+  if (file->read(reinterpret_cast<char *>(&header), sizeof(header)) !=
+          sizeof(header) ||
+      std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != VERSION || header.sourceSize != source.size ||
+      header.sourceModified != source.modified ||
+      header.pathLength != source.path.size() || header.levelCount == 0) {
+    return nullptr;
+  }
+  std::string path(header.pathLength, '\0');
+  if (file->read(path.data(), path.size()) != qint64(path.size()) ||
+      path != source.path) {
+    // A different image whose cache file name happened to collide
+    return nullptr;
+  }
+  std::vector<LevelHeader> levelHeaders(header.levelCount);
+  qint64 levelBytes = header.levelCount * sizeof(LevelHeader);
+  if (file->read(reinterpret_cast<char *>(levelHeaders.data()), levelBytes) !=
+      levelBytes) {
+    return nullptr;
+  }
+
+  const uchar *data = file->map(0, fileSize);
+  if (!data) {
+    return nullptr;
+  }
+  std::vector<Texture::Level> levels;
+  for (const LevelHeader &level : levelHeaders) {
+    quint64 bytes = quint64(level.width) * level.height * sizeof(RGBA);
+    if (level.offset + bytes > quint64(fileSize)) {
+      std::cout << "truncated texture cache file: " << filename << std::endl;
+      return nullptr;
+    }
+    levels.push_back(
+        Texture::Level{int(level.width), int(level.height),
+                       reinterpret_cast<const RGBA *>(data + level.offset)});
+  }
+  // The texture keeps the file, and with it the mapping, alive
+  return std::make_shared<const Texture>(std::move(levels), file);
+}
+
+bool TextureFile::write(const Texture &texture, const std::string &filename,
+                        const Source &source) {
+  for (int i = 0; i < texture.levelCount(); i++) {
+    if (!texture.level(i).texels) {
+      // Tiled textures are already stored on disk
+      return false;
+    }
+  }
+  QSaveFile file(QString::fromStdString(filename));
+  if (!file.open(QFile::WriteOnly)) {
+    return false;
+  }
+
+  Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.sourceSize = source.size;
+  header.sourceModified = source.modified;
+  header.pathLength = source.path.size();
+  header.levelCount = texture.levelCount();
+
+  std::vector<LevelHeader> levels(header.levelCount);
+  quint64 offset = sizeof(Header) + source.path.size() +
+                   header.levelCount * sizeof(LevelHeader);
+  for (int i = 0; i < texture.levelCount(); i++) {
+    const Texture::Level &level = texture.level(i);
+    levels[i].width = level.width;
+    levels[i].height = level.height;
+    levels[i].offset = offset;
+    offset += quint64(level.width) * level.height * sizeof(RGBA);
+  }
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(source.path.data(), source.path.size());
+  file.write(reinterpret_cast<const char *>(levels.data()),
+             levels.size() * sizeof(LevelHeader));
+  for (int i = 0; i < texture.levelCount(); i++) {
+    const Texture::Level &level = texture.level(i);
+    file.write(reinterpret_cast<const char *>(level.texels),
+               qint64(level.width) * level.height * sizeof(RGBA));
+  }
+  return file.commit();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "texture.h"
+#include <QtGlobal>
+#include <memory>
+#include <string>
+
+// Precompiled texture files (.rtc) hold a texture's whole mip pyramid in the
+// layout Texture samples from, so loading one is a memory map with no
+// decoding.
+
+// Each file records the path, size and modification time of the image it was
+// built from. A file whose source has changed since is treated as missing.
+
+// File layout, in native byte order: a Header, the source path, levelCount
+// LevelHeaders, then every level's RGBA8 texels.
+
+class TextureFile {
+public:
+  // Identifies the exact version of a source image.
+  struct Source {
+    std::string path;
+    qint64 size;
+    qint64 modified; // Milliseconds since the epoch
+  };
+
+  // Looks up the current size and modification time of the image at path.
+  // Returns false if the image doesn't exist.
+  static bool describe(const std::string &path, Source &source);
+
+  // Maps the precompiled texture in filename. Returns nullptr if the file is
+  // missing, invalid, or was built from a different version of source.
+  static std::shared_ptr<const Texture> load(const std::string &filename,
+                                             const Source &source);
+
+  // Writes an in-memory texture built from source to filename. The file is
+  // replaced atomically, so concurrent renders never map a partial file.
+  static bool write(const Texture &texture, const std::string &filename,
+                    const Source &source);
+
+private:
+  struct Header {
+    char magic[4];
+    quint32 version;
+    qint64 sourceSize;
+    qint64 sourceModified;
+    quint32 pathLength;
+    quint32 levelCount;
+  };
+
+  struct LevelHeader {
+    quint32 width;
+    quint32 height;
+    quint64 offset; // Byte offset of the level's texels
+  };
+};
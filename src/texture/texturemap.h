@@ -0,0 +1,40 @@
+#pragma once
+
+#include "texture.h"
+#include <glm/glm.hpp>
+#include <memory>
+
+// A texture bound to a surface, with the material's repeat factors.
+
+// Surface coordinates (u, v) run from (0, 0) at the bottom-left of the image
+// to (1, 1) at the top-right, before repeats are applied.
+
+struct TextureMap {
+  std::shared_ptr<const Texture> texture;
+  float repeatU = 1;
+  float repeatV = 1;
+
+  // Point-samples the full-resolution texture at uv.
+  glm::vec4 sample(glm::vec2 uv) const {
+    return texture->sampleNearest(toTextureSpace(uv));
+  }
+
+  // Filters the texture over the footprint spanned by uv and the surface
+  // coordinates uvdx and uvdy seen through the neighbouring pixels.
+  glm::vec4 sample(glm::vec2 uv, glm::vec2 uvdx, glm::vec2 uvdy) const {
+    return texture->sampleTrilinear(toTextureSpace(uv),
+                                    toTextureDelta(uvdx - uv),
+                                    toTextureDelta(uvdy - uv));
+  }
+
+private:
+  glm::vec2 toTextureSpace(glm::vec2 uv) const {
+    return glm::vec2(uv.x * repeatU, (1 - uv.y) * repeatV);
+  }
+
+  glm::vec2 toTextureDelta(glm::vec2 duv) const {
+    // Take the short way around the seam where u or v wraps from 1 to 0
+    duv -= glm::round(duv);
+    return glm::vec2(duv.x * repeatU, -duv.y * repeatV);
+  }
+};
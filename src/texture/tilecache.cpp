@@ -0,0 +1,60 @@
+#include "tilecache.h"
+
+TileCache &TileCache::instance() {
+  static TileCache cache;
+  return cache;
+}
+
+void TileCache::setCapacity(std::size_t bytes) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_capacity = bytes;
+  evict();
+}
+
+std::shared_ptr<const TiledTexture::Tile>
+TileCache::get(const TiledTexture &texture, int level, int tileX, int tileY) {
+  Key key{texture.id(), static_cast<std::uint32_t>(level),
+          static_cast<std::uint32_t>(tileX), static_cast<std::uint32_t>(tileY)};
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(key);
+    if (it != m_index.end()) {
+      m_entries.splice(m_entries.begin(), m_entries, it->second);
+      m_hits++;
+      return it->second->second;
+    }
+  }
+
+  // Read outside the lock so other threads keep hitting the cache meanwhile
+  std::shared_ptr<const TiledTexture::Tile> tile =
+      texture.readTile(level, tileX, tileY);
+  m_misses++;
+  m_bytesRead += TiledTexture::TILE_BYTES;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_index.find(key);
+  if (it != m_index.end()) {
+    // Another thread read the same tile first
+    return it->second->second;
+  }
+  m_entries.emplace_front(key, tile);
+  m_index[key] = m_entries.begin();
+  m_size += TiledTexture::TILE_BYTES;
+  evict();
+  return tile;
+}
+
+void TileCache::addLocalHits(std::uint64_t hits) { m_localHits += hits; }
+
+TileCache::Stats TileCache::stats() const {
+  return Stats{m_localHits, m_hits, m_misses, m_bytesRead};
+}
+
+void TileCache::evict() {
+  // Always keep the newest tile, even if the budget is smaller than a tile
+  while (m_size > m_capacity && m_entries.size() > 1) {
+    m_index.erase(m_entries.back().first);
+    m_entries.pop_back();
+    m_size -= TiledTexture::TILE_BYTES;
+  }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "tiledtexture.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// A fixed-size, process-wide LRU cache of texture tiles.
+
+// All render threads share it. Tiles are handed out as shared pointers, so a
+// tile evicted while a thread is still sampling it stays alive until released.
+
+class TileCache {
+public:
+  struct Stats {
+    std::uint64_t localHits; // Answered by a thread's last tile
+    std::uint64_t hits;
+    std::uint64_t misses;
+    std::uint64_t bytesRead;
+  };
+
+  static TileCache &instance();
+
+  // Sets the memory budget for resident tiles, evicting tiles if needed.
+  void setCapacity(std::size_t bytes);
+
+  // Returns a tile of texture, reading it from disk on a miss.
+  std::shared_ptr<const TiledTexture::Tile>
+  get(const TiledTexture &texture, int level, int tileX, int tileY);
+
+  // Counts lookups that a thread answered without asking the cache, as
+  // TiledTexture::flushStats() reports them.
+  void addLocalHits(std::uint64_t hits);
+
+  Stats stats() const;
+
+private:
+  struct Key {
+    std::uint32_t texture;
+    std::uint32_t level;
+    std::uint32_t tileX;
+    std::uint32_t tileY;
+    bool operator==(const Key &other) const {
+      return texture == other.texture && level == other.level &&
+             tileX == other.tileX && tileY == other.tileY;
+    }
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const Key &key) const {
+      std::uint64_t h = key.texture;
+      h = h * 0x9E3779B97F4A7C15ull + key.level;
+      h = h * 0x9E3779B97F4A7C15ull + key.tileX;
+      h = h * 0x9E3779B97F4A7C15ull + key.tileY;
+      return static_cast<std::size_t>(h ^ (h >> 32));
+    }
+  };
+
+  using Entry = std::pair<Key, std::shared_ptr<const TiledTexture::Tile>>;
+
+  TileCache() = default;
+
+  void evict();
+
+  mutable std::mutex m_mutex;
+  std::size_t m_capacity = 256 << 20;
+  std::size_t m_size = 0;
+  // Most recently used first
+  std::list<Entry> m_entries;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+
+  std::atomic<std::uint64_t> m_localHits = 0;
+  std::atomic<std::uint64_t> m_hits = 0;
+  std::atomic<std::uint64_t> m_misses = 0;
+  std::atomic<std::uint64_t> m_bytesRead = 0;
+};
@@ -0,0 +1,179 @@
+#include "tiledtexture.h"
+#include "tilecache.h"
+
+#include <QSaveFile>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+constexpr char MAGIC[4] = {'R', 'T', 'E', 'X'};
+constexpr std::uint32_t VERSION = 1;
+
+// Limits on what a file header may claim, well past any real texture, so a
+// corrupt header is rejected before it sizes allocations or tile indices
+constexpr std::uint32_t MAX_LEVELS = 32;
+constexpr std::uint32_t MAX_LEVEL_SIZE = 1 << 24;
+
+int tileCount(int size) {
+  return (size + TiledTexture::TILE_SIZE - 1) / TiledTexture::TILE_SIZE;
+}
+
+// Lookups this thread answered from its last tile, not yet counted by the
+// TileCache
+thread_local std::uint64_t lastTileHits = 0;
+
+} // namespace
+
+std::shared_ptr<TiledTexture> TiledTexture::open(const std::string &filename) {
+  static std::atomic<std::uint32_t> nextId = 0;
+
+  std::shared_ptr<TiledTexture> texture(new TiledTexture());
+  texture->m_file.setFileName(QString::fromStdString(filename));
+  if (!texture->m_file.open(QFile::ReadOnly)) {
+    std::cout << "could not open " << filename << std::endl;
+    return nullptr;
+  }
+  FileHeader header;
+  if (texture->m_file.read(reinterpret_cast<char *>(&header),
+                           sizeof(header)) != sizeof(header) ||
+      std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != VERSION || header.tileSize != TILE_SIZE ||
+      header.levelCount == 0 || header.levelCount > MAX_LEVELS) {
+    std::cout << "invalid tiled texture file: " << filename << std::endl;
+    return nullptr;
+  }
+  texture->m_levels.resize(header.levelCount);
+  qint64 levelBytes = header.levelCount * sizeof(LevelHeader);
+  if (texture->m_file.read(reinterpret_cast<char *>(texture->m_levels.data()),
+                           levelBytes) != levelBytes) {
+    std::cout << "invalid tiled texture file: " << filename << std::endl;
+    return nullptr;
+  }
+  std::uint64_t fileSize = texture->m_file.size();
+  for (const LevelHeader &level : texture->m_levels) {
+    if (level.width == 0 || level.height == 0 ||
+        level.width > MAX_LEVEL_SIZE || level.height > MAX_LEVEL_SIZE) {
+      std::cout << "invalid tiled texture file: " << filename << std::endl;
+      return nullptr;
+    }
+    std::uint64_t bytes = static_cast<std::uint64_t>(tileCount(level.width)) *
+                          tileCount(level.height) * TILE_BYTES;
+    if (level.offset > fileSize || bytes > fileSize - level.offset) {
+      std::cout << "truncated tiled texture file: " << filename << std::endl;
+      return nullptr;
+    }
+  }
+  texture->m_id = nextId++;
+  return texture;
+}
+
+bool TiledTexture::write(const Texture &texture, const std::string &filename) {
+  QSaveFile file(QString::fromStdString(filename));
+  if (!file.open(QFile::WriteOnly)) {
+    std::cout << "could not open " << filename << " for writing" << std::endl;
+    return false;
+  }
+
+  FileHeader header;
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.tileSize = TILE_SIZE;
+  header.levelCount = texture.levelCount();
+
+  std::vector<LevelHeader> levels(header.levelCount);
+  std::uint64_t offset =
+      sizeof(FileHeader) + header.levelCount * sizeof(LevelHeader);
+  for (int i = 0; i < texture.levelCount(); i++) {
+    const Texture::Level &level = texture.level(i);
+    levels[i].width = level.width;
+    levels[i].height = level.height;
+    levels[i].offset = offset;
+    offset += static_cast<std::uint64_t>(tileCount(level.width)) *
+              tileCount(level.height) * TILE_BYTES;
+  }
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  file.write(reinterpret_cast<const char *>(levels.data()),
+             levels.size() * sizeof(LevelHeader));
+
+  Tile tile(TILE_SIZE * TILE_SIZE);
+  for (int i = 0; i < texture.levelCount(); i++) {
+    const Texture::Level &level = texture.level(i);
+    for (int tileY = 0; tileY < tileCount(level.height); tileY++) {
+      for (int tileX = 0; tileX < tileCount(level.width); tileX++) {
+        for (int y = 0; y < TILE_SIZE; y++) {
+          int sourceY = std::min(tileY * TILE_SIZE + y, level.height - 1);
+          for (int x = 0; x < TILE_SIZE; x++) {
+            int sourceX = std::min(tileX * TILE_SIZE + x, level.width - 1);
+            tile[y * TILE_SIZE + x] = texture.texel(i, sourceX, sourceY);
+          }
+        }
+        file.write(reinterpret_cast<const char *>(tile.data()), TILE_BYTES);
+      }
+    }
+  }
+  if (!file.commit()) {
+    std::cout << "could not write " << filename << ": "
+              << file.errorString().toStdString() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool TiledTexture::isTiledTextureFile(const std::string &filename) {
+  return filename.size() >= 5 &&
+         filename.compare(filename.size() - 5, 5, ".rtex") == 0;
+}
+
+RGBA TiledTexture::texel(int level, int x, int y) const {
+  // Neighbouring lookups almost always hit the same tile, so each thread
+  // remembers its last tile and skips the shared cache when it matches
+  thread_local struct {
+    std::uint32_t texture = UINT32_MAX;
+    int level;
+    int tileX;
+    int tileY;
+    std::shared_ptr<const Tile> tile;
+  } last;
+
+  int tileX = x / TILE_SIZE;
+  int tileY = y / TILE_SIZE;
+  if (last.texture != m_id || last.level != level || last.tileX != tileX ||
+      last.tileY != tileY) {
+    last.tile = TileCache::instance().get(*this, level, tileX, tileY);
+    last.texture = m_id;
+    last.level = level;
+    last.tileX = tileX;
+    last.tileY = tileY;
+  } else {
+    lastTileHits++;
+  }
+  return (*last.tile)[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+}
+
+void TiledTexture::flushStats() {
+  if (lastTileHits > 0) {
+    TileCache::instance().addLocalHits(lastTileHits);
+    lastTileHits = 0;
+  }
+}
+
+std::shared_ptr<const TiledTexture::Tile>
+TiledTexture::readTile(int level, int tileX, int tileY) const {
+  const LevelHeader &header = m_levels[level];
+  std::uint64_t index =
+      static_cast<std::uint64_t>(tileY) * tileCount(header.width) + tileX;
+  auto tile = std::make_shared<Tile>(TILE_SIZE * TILE_SIZE);
+  std::lock_guard<std::mutex> lock(m_fileMutex);
+  if (!m_file.seek(header.offset + index * TILE_BYTES) ||
+      m_file.read(reinterpret_cast<char *>(tile->data()), TILE_BYTES) !=
+          static_cast<qint64>(TILE_BYTES)) {
+    // A truncated file shows up as black tiles rather than a crash mid-render
+    std::cout << "could not read tile from "
+              << m_file.fileName().toStdString() << std::endl;
+    std::fill(tile->begin(), tile->end(), RGBA{0, 0, 0, 255});
+  }
+  return tile;
+}
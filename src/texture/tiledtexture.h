@@ -0,0 +1,77 @@
+#pragma once
+
+#include "texture.h"
+#include "utils/rgba.h"
+#include <QFile>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A texture stored on disk as fixed-size tiles, one mip level after another.
+
+// Tiles are read on demand through the shared TileCache, so a scene can
+// reference far more texture data than fits in memory. Edge tiles are padded
+// by repeating the last row and column, so every tile has the same size.
+
+// File layout, in native byte order: a FileHeader, levelCount LevelHeaders,
+// then each level's tiles row by row, TILE_SIZE x TILE_SIZE RGBA8 texels each.
+
+class TiledTexture {
+public:
+  static constexpr int TILE_SIZE = 64;
+  static constexpr std::size_t TILE_BYTES =
+      TILE_SIZE * TILE_SIZE * sizeof(RGBA);
+
+  using Tile = std::vector<RGBA>;
+
+  // Opens a tiled texture file. Returns nullptr if it is missing or invalid.
+  static std::shared_ptr<TiledTexture> open(const std::string &filename);
+
+  // Writes every level of a texture to filename as tiles. Compressed and
+  // tiled textures are decoded texel by texel. Returns false if the file
+  // could not be written.
+  static bool write(const Texture &texture, const std::string &filename);
+
+  // Returns true if filename names a tiled texture file rather than an image.
+  static bool isTiledTextureFile(const std::string &filename);
+
+  int levelCount() const { return static_cast<int>(m_levels.size()); }
+  int levelWidth(int level) const { return m_levels[level].width; }
+  int levelHeight(int level) const { return m_levels[level].height; }
+
+  // A process-unique id for this open file, used to key cached tiles.
+  std::uint32_t id() const { return m_id; }
+
+  // Returns texel (x, y) of a level, paging its tile in if needed.
+  RGBA texel(int level, int x, int y) const;
+
+  // Adds the calling thread's lookups that its last tile answered, without
+  // going to the TileCache, to the cache's stats.
+  static void flushStats();
+
+  // Reads one tile from disk. Called by TileCache on a miss.
+  std::shared_ptr<const Tile> readTile(int level, int tileX, int tileY) const;
+
+private:
+  struct FileHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t tileSize;
+    std::uint32_t levelCount;
+  };
+
+  struct LevelHeader {
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint64_t offset; // Byte offset of the level's first tile
+  };
+
+  TiledTexture() = default;
+
+  std::uint32_t m_id;
+  std::vector<LevelHeader> m_levels;
+  mutable QFile m_file;
+  mutable std::mutex m_fileMutex;
+};
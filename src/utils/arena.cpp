@@ -0,0 +1,68 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <memory>
+#include <new>
+
+// Blocks grow geometrically up to this size, so big scenes need few of them
+static constexpr std::size_t MAX_BLOCK_SIZE = 4 << 20;
+
+Arena::Arena(std::size_t blockSize)
+    : m_blockSize(std::max<std::size_t>(blockSize, 256)),
+      m_nextBlockSize(m_blockSize) {}
+
+Arena::~Arena() { release(); }
+
+void Arena::release() {
+  for (Finalizer *finalizer = m_finalizers; finalizer;
+       finalizer = finalizer->next) {
+    finalizer->destroy(finalizer->object);
+  }
+  m_finalizers = nullptr;
+
+  while (m_blocks) {
+    Block *next = m_blocks->next;
+    ::operator delete(m_blocks);
+    m_blocks = next;
+  }
+  m_cursor = m_end = nullptr;
+  m_nextBlockSize = m_blockSize;
+}
+
+std::byte *Arena::newBlock(std::size_t size) {
+  // The header is padded so that what follows is maximally aligned
+  constexpr std::size_t header =
+      (sizeof(Block) + alignof(std::max_align_t) - 1) &
+      ~(alignof(std::max_align_t) - 1);
+  Block *block = static_cast<Block *>(::operator new(header + size));
+  block->next = m_blocks;
+  m_blocks = block;
+  return reinterpret_cast<std::byte *>(block) + header;
+}
+
+void *Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+  void *cursor = m_cursor;
+  std::size_t space = m_end - m_cursor;
+  if (m_cursor && std::align(alignment, bytes, cursor, space)) {
+    m_cursor = static_cast<std::byte *>(cursor) + bytes;
+    return cursor;
+  }
+
+  std::size_t size = bytes + alignment;
+  // Large allocations, such as a big container's storage, get a block of
+  // their own, leaving the current block to be filled
+  if (size > m_nextBlockSize / 4) {
+    void *memory = newBlock(size);
+    return std::align(alignment, bytes, memory, size);
+  }
+
+  m_cursor = newBlock(m_nextBlockSize);
+  m_end = m_cursor + m_nextBlockSize;
+  m_nextBlockSize = std::min(m_nextBlockSize * 2, MAX_BLOCK_SIZE);
+  return do_allocate(bytes, alignment);
+}
+
+bool Arena::do_is_equal(
+    const std::pmr::memory_resource &other) const noexcept {
+  return this == &other;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <type_traits>
+#include <utility>
+
+// A bump allocator for data that lives exactly as long as a scene.
+
+// Objects are carved out of large blocks one after another and never freed
+// one at a time: the whole arena is released at once, running the
+// destructors of the objects that have one, newest first. Building and
+// tearing down a scene of a million nodes then costs an allocation per few
+// megabytes rather than several per node.
+//
+// It's also a memory resource, so containers inside objects made in the
+// arena can take their storage from it too; memory they give back is only
+// reclaimed on release. An arena isn't thread-safe, and can't be copied or
+// moved, since such containers keep its address.
+
+class Arena : public std::pmr::memory_resource {
+public:
+  static constexpr std::size_t DEFAULT_BLOCK_SIZE = 64 << 10;
+
+  explicit Arena(std::size_t blockSize = DEFAULT_BLOCK_SIZE);
+  ~Arena() override;
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // Constructs a T in the arena. Allocator-aware types, such as those holding
+  // pmr containers, are given the arena as their allocator.
+  template <typename T, typename... Args> T *make(Args &&...args);
+
+  // Destroys everything made in the arena and frees all its memory.
+  void release();
+
+private:
+  struct Block {
+    Block *next;
+  };
+
+  struct Finalizer {
+    void (*destroy)(void *);
+    void *object;
+    Finalizer *next;
+  };
+
+  void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+  void do_deallocate(void *, std::size_t, std::size_t) override {}
+  bool
+  do_is_equal(const std::pmr::memory_resource &other) const noexcept override;
+
+  // Allocates a block with room for size bytes after its header
+  std::byte *newBlock(std::size_t size);
+
+  std::size_t m_blockSize;
+  std::size_t m_nextBlockSize;
+  Block *m_blocks = nullptr;
+  std::byte *m_cursor = nullptr;
+  std::byte *m_end = nullptr;
+  Finalizer *m_finalizers = nullptr;
+};
+
+template <typename T, typename... Args> T *Arena::make(Args &&...args) {
+  std::pmr::polymorphic_allocator<> allocator(this);
+  // Reserve the finalizer first, so a constructed object is always destroyed
+  Finalizer *finalizer = nullptr;
+  if constexpr (!std::is_trivially_destructible_v<T>) {
+    finalizer = allocator.allocate_object<Finalizer>();
+  }
+  T *object = allocator.allocate_object<T>();
+  allocator.construct(object, std::forward<Args>(args)...);
+  if constexpr (!std::is_trivially_destructible_v<T>) {
+    finalizer->destroy = [](void *p) { static_cast<T *>(p)->~T(); };
+    finalizer->object = object;
+    finalizer->next = m_finalizers;
+    m_finalizers = finalizer;
+  }
+  return object;
+}
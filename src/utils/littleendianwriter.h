@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QtEndian>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Appends values to the bytes of a little-endian binary file, such as the
+// headers of the OpenEXR and TIFF files the renderer writes.
+
+class LittleEndianWriter {
+public:
+  std::string bytes;
+
+  void uint16(std::uint16_t value) { raw(qToLittleEndian(value)); }
+  void int32(std::int32_t value) { raw(qToLittleEndian(value)); }
+  void uint32(std::uint32_t value) { raw(qToLittleEndian(value)); }
+  void uint64(std::uint64_t value) { raw(qToLittleEndian(value)); }
+  void float32(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32(bits);
+  }
+  // Appends value and its terminating null
+  void string(const std::string &value) {
+    bytes.append(value.c_str(), value.size() + 1);
+  }
+
+private:
+  template <typename T> void raw(T value) {
+    bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory_resource>
 #include <vector>
 #include <string>
 
@@ -10,7 +11,7 @@ enum class LightType {
     LIGHT_POINT,
     LIGHT_DIRECTIONAL,
     LIGHT_SPOT,
-    LIGHT_AREA // No longer supported
+    LIGHT_AREA
 };
 
 // Enum of the types of primitives that might be in the scene
@@ -57,7 +58,7 @@ struct SceneLightData {
     float penumbra;      // Only applicable to spot lights, in RADIANS
     float angle;         // Only applicable to spot lights, in RADIANS
 
-    float width, height; // No longer supported (area lights)
+    float width, height; // Only applicable to area lights
 };
 
 // Struct which contains data for the camera of a scene
@@ -72,9 +73,15 @@ struct SceneCameraData {
     float focalLength;   // Only applicable for depth of field
 };
 
+// Struct which contains the camera of an animated scene at one point in time
+struct SceneCameraKeyframe {
+    float time;          // In seconds
+    SceneCameraData camera;
+};
+
 // Struct which contains data for texture mapping files
 struct SceneFileMap {
-    SceneFileMap() : isUsed(false) {}
+    SceneFileMap() : isUsed(false), compress(false) {}
 
     bool isUsed;
     std::string filename;
@@ -82,11 +89,14 @@ struct SceneFileMap {
     float repeatU;
     float repeatV;
 
+    bool compress; // Keep the texture block-compressed in memory
+
     void clear() {
        isUsed = false;
        repeatU = 0.0f;
        repeatV = 0.0f;
        filename = std::string();
+       compress = false;
     }
 };
 
@@ -134,8 +144,25 @@ struct ScenePrimitive {
    std::string   meshfile; // Used for triangle meshes
 };
 
+// Struct which contains the values of an animated transformation at one point in time.
+// Only the values applicable to the transformation's type are used.
+struct SceneTransformationKeyframe {
+    float time;          // In seconds
+    glm::vec3 translate;
+    glm::vec3 scale;
+    glm::vec3 rotate;
+    float angle;         // In RADIANS
+};
+
 // Struct which contains data for a transformation.
+// Its keyframes take their storage from the allocator it's constructed with, usually the reader's arena.
 struct SceneTransformation {
+    using allocator_type = std::pmr::polymorphic_allocator<>;
+
+    explicit SceneTransformation(const allocator_type &allocator = {})
+        : type(TransformationType::TRANSFORMATION_MATRIX), translate(0.f), scale(1.f), rotate(0.f, 1.f, 0.f),
+          angle(0.f), matrix(1.f), keyframes(allocator) {}
+
     TransformationType type;
    
     glm::vec3 translate; // Only applicable when translating. Defines t_x, t_y, and t_z, the amounts to translate by, along each axis.
@@ -143,12 +170,21 @@ struct SceneTransformation {
     glm::vec3 rotate;    // Only applicable when rotating.    Defines the axis of rotation; should be a unit vector.
     float angle;         // Only applicable when rotating.    Defines the angle to rotate by in RADIANS, following the right-hand rule.
     glm::mat4 matrix;    // Only applicable when transforming by a custom matrix. This is that custom matrix.
+
+    // In time order; empty unless the transformation is animated, in which case the values above are unused
+    std::pmr::vector<SceneTransformationKeyframe> keyframes;
 };
 
 // Struct which represents a node in the scene graph/tree, to be parsed by the student's `SceneParser`.
+// Its lists take their storage from the allocator it's constructed with, usually the reader's arena.
 struct SceneNode {
-   std::vector<SceneTransformation*> transformations; // Note the order of transformations described in lab 5
-   std::vector<ScenePrimitive*>      primitives;
-   std::vector<SceneNode*>           children;
+   using allocator_type = std::pmr::polymorphic_allocator<>;
+
+   explicit SceneNode(const allocator_type &allocator = {})
+       : transformations(allocator), primitives(allocator), children(allocator) {}
+
+   std::pmr::vector<SceneTransformation*> transformations; // Note the order of transformations described in lab 5
+   std::pmr::vector<ScenePrimitive*>      primitives;
+   std::pmr::vector<SceneNode*>           children;
 };
 
@@ -0,0 +1,244 @@
+#include "scenefile.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr char MAGIC[4] = {'R', 'S', 'C', 'F'};
+constexpr quint32 VERSION = 1;
+
+// Arrays start on this boundary so they can be read in place
+constexpr quint64 ALIGNMENT = 16;
+
+static_assert(std::is_trivially_copyable_v<SceneLightData>);
+static_assert(std::is_trivially_copyable_v<SceneGlobalData>);
+static_assert(std::is_trivially_copyable_v<SceneCameraData>);
+
+quint64 align(quint64 offset) {
+  return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// Interns strings into one table, storing each distinct string once
+class StringTable {
+public:
+  template <typename Record> Record add(const std::string &string) {
+    auto [it, inserted] = m_offsets.try_emplace(string, m_bytes.size());
+    if (inserted) {
+      m_bytes += string;
+    }
+    return Record{static_cast<quint32>(it->second),
+                  static_cast<quint32>(string.size())};
+  }
+
+  const std::string &bytes() const { return m_bytes; }
+
+private:
+  std::unordered_map<std::string, std::size_t> m_offsets;
+  std::string m_bytes;
+};
+
+} // namespace
+
+bool SceneFile::isSceneFile(const std::string &filename) {
+  QFile file(QString::fromStdString(filename));
+  char magic[sizeof(MAGIC)];
+  return file.open(QFile::ReadOnly) &&
+         file.read(magic, sizeof(magic)) == sizeof(magic) &&
+         std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+bool SceneFile::load(const std::string &filename, RenderData &renderData) {
+  QFile file(QString::fromStdString(filename));
+  if (!file.open(QFile::ReadOnly)) {
+    std::cout << "could not open " << filename << std::endl;
+    return false;
+  }
+  quint64 fileSize = file.size();
+  const uchar *data = fileSize >= sizeof(Header) ? file.map(0, fileSize)
+                                                 : nullptr;
+  if (!data) {
+    std::cout << "could not map " << filename << std::endl;
+    return false;
+  }
+  Header header;
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != VERSION) {
+    std::cout << filename << " is not a compiled scene of version " << VERSION
+              << std::endl;
+    return false;
+  }
+  auto fits = [&](quint64 offset, quint64 count, quint64 size) {
+    return offset % ALIGNMENT == 0 && offset <= fileSize &&
+           count <= (fileSize - offset) / size;
+  };
+  if (!fits(header.lights, header.lightCount, sizeof(SceneLightData)) ||
+      !fits(header.materials, header.materialCount, sizeof(MaterialRecord)) ||
+      !fits(header.shapes, header.shapeCount, sizeof(ShapeRecord)) ||
+      !fits(header.strings, header.stringBytes, 1)) {
+    std::cout << "truncated compiled scene: " << filename << std::endl;
+    return false;
+  }
+
+  const char *strings = reinterpret_cast<const char *>(data + header.strings);
+  bool valid = true;
+  auto string = [&](const StringRecord &record) {
+    if (record.offset > header.stringBytes ||
+        record.length > header.stringBytes - record.offset) {
+      valid = false;
+      return std::string();
+    }
+    return std::string(strings + record.offset, record.length);
+  };
+  auto fileMap = [&](const MapRecord &record) {
+    SceneFileMap map;
+    map.isUsed = record.isUsed;
+    map.filename = string(record.filename);
+    map.repeatU = record.repeatU;
+    map.repeatV = record.repeatV;
+    map.compress = record.compress;
+    return map;
+  };
+
+  const auto *materialRecords =
+      reinterpret_cast<const MaterialRecord *>(data + header.materials);
+  std::vector<SceneMaterial> materials(header.materialCount);
+  for (quint32 m = 0; m < header.materialCount; m++) {
+    const MaterialRecord &record = materialRecords[m];
+    SceneMaterial &material = materials[m];
+    material.cAmbient = record.cAmbient;
+    material.cDiffuse = record.cDiffuse;
+    material.cSpecular = record.cSpecular;
+    material.shininess = record.shininess;
+    material.cReflective = record.cReflective;
+    material.cTransparent = record.cTransparent;
+    material.ior = record.ior;
+    material.textureMap = fileMap(record.textureMap);
+    material.blend = record.blend;
+    material.cEmissive = record.cEmissive;
+    material.bumpMap = fileMap(record.bumpMap);
+  }
+
+  const auto *lights =
+      reinterpret_cast<const SceneLightData *>(data + header.lights);
+  const auto *shapeRecords =
+      reinterpret_cast<const ShapeRecord *>(data + header.shapes);
+  renderData.globalData = header.globalData;
+  renderData.cameraData = header.cameraData;
+  renderData.lights.assign(lights, lights + header.lightCount);
+  renderData.shapes.clear();
+  renderData.shapes.reserve(header.shapeCount);
+  for (quint32 s = 0; s < header.shapeCount && valid; s++) {
+    const ShapeRecord &record = shapeRecords[s];
+    if (record.material >= header.materialCount ||
+        record.type > static_cast<quint32>(PrimitiveType::PRIMITIVE_MESH)) {
+      valid = false;
+      break;
+    }
+    RenderShapeData shape;
+    shape.primitive.type = static_cast<PrimitiveType>(record.type);
+    shape.primitive.material = materials[record.material];
+    shape.primitive.meshfile = string(record.meshfile);
+    shape.ctm = record.ctm;
+    renderData.shapes.push_back(std::move(shape));
+  }
+  if (!valid) {
+    std::cout << "corrupt compiled scene: " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool SceneFile::write(const RenderData &renderData,
+                      const std::string &filename) {
+  StringTable strings;
+  auto fileMap = [&](const SceneFileMap &map) {
+    MapRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.filename = strings.add<StringRecord>(map.filename);
+    record.repeatU = map.repeatU;
+    record.repeatV = map.repeatV;
+    record.isUsed = map.isUsed;
+    record.compress = map.compress;
+    return record;
+  };
+
+  // Shapes mostly share a few materials, so each distinct one is stored once.
+  // Records are zeroed first, so equal materials have equal bytes.
+  std::vector<MaterialRecord> materials;
+  std::unordered_map<std::string, quint32> materialIndices;
+  std::vector<ShapeRecord> shapes(renderData.shapes.size());
+  for (std::size_t s = 0; s < renderData.shapes.size(); s++) {
+    const ScenePrimitive &primitive = renderData.shapes[s].primitive;
+    const SceneMaterial &material = primitive.material;
+    MaterialRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.cAmbient = material.cAmbient;
+    record.cDiffuse = material.cDiffuse;
+    record.cSpecular = material.cSpecular;
+    record.cReflective = material.cReflective;
+    record.cTransparent = material.cTransparent;
+    record.cEmissive = material.cEmissive;
+    record.shininess = material.shininess;
+    record.ior = material.ior;
+    record.blend = material.blend;
+    record.textureMap = fileMap(material.textureMap);
+    record.bumpMap = fileMap(material.bumpMap);
+    std::string key(reinterpret_cast<const char *>(&record), sizeof(record));
+    auto [it, inserted] = materialIndices.try_emplace(key, materials.size());
+    if (inserted) {
+      materials.push_back(record);
+    }
+
+    ShapeRecord &shape = shapes[s];
+    std::memset(&shape, 0, sizeof(shape));
+    shape.ctm = renderData.shapes[s].ctm;
+    shape.type = static_cast<quint32>(primitive.type);
+    shape.material = it->second;
+    shape.meshfile = strings.add<StringRecord>(primitive.meshfile);
+  }
+
+  Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.globalData = renderData.globalData;
+  header.cameraData = renderData.cameraData;
+  header.lightCount = renderData.lights.size();
+  header.materialCount = materials.size();
+  header.shapeCount = shapes.size();
+  header.stringBytes = strings.bytes().size();
+  header.lights = align(sizeof(Header));
+  header.materials =
+      align(header.lights + header.lightCount * sizeof(SceneLightData));
+  header.shapes =
+      align(header.materials + header.materialCount * sizeof(MaterialRecord));
+  header.strings =
+      align(header.shapes + header.shapeCount * sizeof(ShapeRecord));
+
+  QSaveFile file(QString::fromStdString(filename));
+  if (!file.open(QFile::WriteOnly)) {
+    std::cout << "could not open " << filename << std::endl;
+    return false;
+  }
+  auto writeAt = [&](quint64 offset, const void *bytes, quint64 size) {
+    static const char padding[ALIGNMENT] = {};
+    file.write(padding, offset - file.pos());
+    file.write(reinterpret_cast<const char *>(bytes), size);
+  };
+  writeAt(0, &header, sizeof(header));
+  writeAt(header.lights, renderData.lights.data(),
+          header.lightCount * sizeof(SceneLightData));
+  writeAt(header.materials, materials.data(),
+          header.materialCount * sizeof(MaterialRecord));
+  writeAt(header.shapes, shapes.data(),
+          header.shapeCount * sizeof(ShapeRecord));
+  writeAt(header.strings, strings.bytes().data(), header.stringBytes);
+  return file.commit();
+}
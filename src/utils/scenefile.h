@@ -0,0 +1,89 @@
+#pragma once
+
+#include "sceneparser.h"
+#include <QtGlobal>
+#include <string>
+
+// Compiled scene files (.rsc) hold a scene already flattened into what the
+// renderer needs: the global data, camera, lights, and every shape with its
+// cumulative transformation. Loading one maps the file and copies its arrays
+// out, with no XML to parse and no scene graph to walk.
+
+// Shapes refer to a table of distinct materials, and strings such as texture
+// paths are stored once in a string table. Paths are kept as the XML reader
+// resolved them, so a compiled scene finds its textures wherever it's loaded
+// from.
+
+// A compiled scene is a single still pose: animated scenes, whose keyframes
+// it has no place for, can't be compiled. The BVH isn't stored either; the
+// renderer builds it from the loaded shapes, so files don't depend on its
+// layout.
+
+// File layout, in native byte order: a Header, then the lights, materials,
+// shapes and string table, each starting on a 16-byte boundary.
+
+class SceneFile {
+public:
+  // Returns true if filename starts like a compiled scene.
+  static bool isSceneFile(const std::string &filename);
+
+  // Reads the compiled scene in filename into renderData. Returns false if
+  // the file is missing, invalid or from another version.
+  static bool load(const std::string &filename, RenderData &renderData);
+
+  // Writes renderData to filename. The file is replaced atomically, so
+  // concurrent renders never map a partial file.
+  static bool write(const RenderData &renderData, const std::string &filename);
+
+private:
+  struct Header {
+    char magic[4];
+    quint32 version;
+    SceneGlobalData globalData;
+    SceneCameraData cameraData;
+    quint32 lightCount;
+    quint32 materialCount;
+    quint32 shapeCount;
+    quint32 stringBytes;
+    // Byte offsets of each array
+    quint64 lights;
+    quint64 materials;
+    quint64 shapes;
+    quint64 strings;
+  };
+
+  // A slice of the string table
+  struct StringRecord {
+    quint32 offset;
+    quint32 length;
+  };
+
+  struct MapRecord {
+    StringRecord filename;
+    float repeatU;
+    float repeatV;
+    quint32 isUsed;
+    quint32 compress;
+  };
+
+  struct MaterialRecord {
+    SceneColor cAmbient;
+    SceneColor cDiffuse;
+    SceneColor cSpecular;
+    SceneColor cReflective;
+    SceneColor cTransparent;
+    SceneColor cEmissive;
+    float shininess;
+    float ior;
+    float blend;
+    MapRecord textureMap;
+    MapRecord bumpMap;
+  };
+
+  struct ShapeRecord {
+    glm::mat4 ctm;
+    quint32 type;
+    quint32 material;
+    StringRecord meshfile;
+  };
+};
@@ -3,12 +3,14 @@
 
 #include "glm/gtc/type_ptr.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
 #include <filesystem>
 
 #include <QFile>
+#include <QXmlStreamReader>
 
 #define ERROR_AT(e) "error at line " << e.lineNumber() << " col " << e.columnNumber() << ": "
 #define PARSE_ERROR(e) std::cout << ERROR_AT(e) << "could not parse <" << e.tagName().toStdString() \
@@ -26,33 +28,6 @@ ScenefileReader::ScenefileReader(const std::string& name)
    memset(&m_globalData, 0, sizeof(SceneGlobalData));
    m_objects.clear();
    m_lights.clear();
-   m_nodes.clear();
-}
-
-ScenefileReader::~ScenefileReader()
-{
-   std::vector<SceneLightData*>::iterator lights;
-   for (lights = m_lights.begin(); lights != m_lights.end(); lights++) {
-       delete *lights;
-   }
-
-   // Delete all Scene Nodes
-   for (unsigned int node = 0; node < m_nodes.size(); node++) {
-       for (size_t i = 0; i < (m_nodes[node])->transformations.size(); i++) {
-           delete (m_nodes[node])->transformations[i];
-       }
-       for (size_t i = 0; i < (m_nodes[node])->primitives.size(); i++) {
-           delete (m_nodes[node])->primitives[i];
-       }
-       (m_nodes[node])->transformations.clear();
-       (m_nodes[node])->primitives.clear();
-       (m_nodes[node])->children.clear();
-       delete m_nodes[node];
-   }
-
-   m_nodes.clear();
-   m_lights.clear();
-   m_objects.clear();
 }
 
 SceneGlobalData ScenefileReader::getGlobalData() const {
@@ -63,6 +38,18 @@ SceneCameraData ScenefileReader::getCameraData() const {
    return m_cameraData;
 }
 
+const std::vector<SceneCameraKeyframe>& ScenefileReader::getCameraKeyframes() const {
+   return m_cameraKeyframes;
+}
+
+bool ScenefileReader::isAnimated() const {
+   return m_animated;
+}
+
+float ScenefileReader::getDuration() const {
+   return m_duration;
+}
+
 std::vector<SceneLightData> ScenefileReader::getLights() const {
    std::vector<SceneLightData> ret{};
    ret.reserve(m_lights.size());
@@ -80,76 +67,55 @@ SceneNode* ScenefileReader::getRootNode() const {
    return m_objects["root"];
 }
 
-// This is where it all goes down...
-bool ScenefileReader::readXML() {
-   // Read the file
-   QFile file(file_name.c_str());
-   if (!file.open(QFile::ReadOnly)) {
-       std::cout << "could not open " << file_name << std::endl;
-       return false;
-   }
-
-   // Load the XML document
-   QDomDocument doc;
-   QString errorMessage;
-   int errorLine, errorColumn;
-   if (!doc.setContent(&file, &errorMessage, &errorLine, &errorColumn)) {
-       std::cout << "parse error at line " << errorLine << " col " << errorColumn << ": "
-            << errorMessage.toStdString() << std::endl;
-       return false;
-   }
-   file.close();
-
-   // Get the root element
-   QDomElement scenefile = doc.documentElement();
-   if (scenefile.tagName() != "scenefile") {
-       std::cout << "missing <scenefile>" << std::endl;
-       return false;
-   }
-
-   // Default camera
-   m_cameraData.pos = glm::vec4(5.f, 5.f, 5.f, 1.f);
-   m_cameraData.up = glm::vec4(0.f, 1.f, 0.f, 0.f);
-   m_cameraData.look = glm::vec4(-1.f, -1.f, -1.f, 0.f);
-   m_cameraData.heightAngle = 45 * M_PI / 180.f;
+namespace {
 
-   // Default global data
-   m_globalData.ka = 0.5f;
-   m_globalData.kd = 0.5f;
-   m_globalData.ks = 0.5f;
+/**
+* The start element a QXmlStreamReader is on, with the same accessors as a
+* QDomElement, so that the helpers below can parse either. It copies the
+* element's attributes, so it stays valid as the reader moves on.
+*/
+class StreamElement {
+public:
+   explicit StreamElement(const QXmlStreamReader &xml)
+       : m_tagName(xml.name().toString()), m_attributes(xml.attributes()),
+         m_lineNumber(xml.lineNumber()), m_columnNumber(xml.columnNumber()) {}
+
+   QString tagName() const { return m_tagName; }
+   bool hasAttribute(const QString &name) const { return m_attributes.hasAttribute(name); }
+   QString attribute(const QString &name) const { return m_attributes.value(name).toString(); }
+   qint64 lineNumber() const { return m_lineNumber; }
+   qint64 columnNumber() const { return m_columnNumber; }
+   bool isNull() const { return false; }
+
+private:
+   QString m_tagName;
+   QXmlStreamAttributes m_attributes;
+   qint64 m_lineNumber;
+   qint64 m_columnNumber;
+};
 
-   // Iterate over child elements
-   QDomNode childNode = scenefile.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
-       if (e.tagName() == "globaldata") {
-           if (!parseGlobalData(e))
-               return false;
-       } else if (e.tagName() == "lightdata") {
-           if (!parseLightData(e))
-               return false;
-       } else if (e.tagName() == "cameradata") {
-           if (!parseCameraData(e))
-               return false;
-       } else if (e.tagName() == "object") {
-           if (!parseObjectData(e))
-               return false;
-       } else if (!e.isNull()) {
-           UNSUPPORTED_ELEMENT(e);
+/**
+* Calls parseChild on each child element of the element xml is on, leaving xml
+* on that element's end. parseChild may read its element to the end, or leave
+* it to be skipped. Returns false if parseChild does or the XML is malformed.
+*/
+template <typename ParseChild> bool forEachChild(QXmlStreamReader &xml, ParseChild &&parseChild) {
+   while (xml.readNextStartElement()) {
+       if (!parseChild(StreamElement(xml)))
            return false;
-       }
-       childNode = childNode.nextSibling();
+       if (xml.isStartElement())
+           xml.skipCurrentElement();
    }
-
-   std::cout << "Finished reading " << file_name << std::endl;
-   return true;
+   return !xml.hasError();
 }
 
+} // namespace
+
 /**
 * Helper function to parse a single value, the name of which is stored in
 * name.  For example, to parse <length v="0"/>, name would need to be "v".
 */
-bool parseInt(const QDomElement &single, int &a, const char *name) {
+template <typename Element> bool parseInt(const Element &single, int &a, const char *name) {
    if (!single.hasAttribute(name))
        return false;
    a = single.attribute(name).toInt();
@@ -160,7 +126,7 @@ bool parseInt(const QDomElement &single, int &a, const char *name) {
 * Helper function to parse a single value, the name of which is stored in
 * name.  For example, to parse <length v="0"/>, name would need to be "v".
 */
-template <typename T> bool parseSingle(const QDomElement &single, T &a, const QString &str) {
+template <typename Element, typename T> bool parseSingle(const Element &single, T &a, const QString &str) {
    if (!single.hasAttribute(str))
        return false;
    a = single.attribute(str).toDouble();
@@ -172,8 +138,8 @@ template <typename T> bool parseSingle(const QDomElement &single, T &a, const QS
 * letter, which are stored in chars in order.  For example, to parse
 * <pos x="0" y="0" z="0"/>, chars would need to be "xyz".
 */
-template <typename T> bool parseTriple(
-       const QDomElement &triple,
+template <typename Element, typename T> bool parseTriple(
+       const Element &triple,
        T &a,
        T &b,
        T &c,
@@ -195,8 +161,8 @@ template <typename T> bool parseTriple(
 * letter, which are stored in chars in order.  For example, to parse
 * <color r="0" g="0" b="0" a="0"/>, chars would need to be "rgba".
 */
-template <typename T> bool parseQuadruple(
-       const QDomElement &quadruple,
+template <typename Element, typename T> bool parseQuadruple(
+       const Element &quadruple,
        T &a,
        T &b,
        T &c,
@@ -217,6 +183,24 @@ template <typename T> bool parseQuadruple(
    return true;
 }
 
+/**
+* Helper function to parse one row of a matrix into column col of m, as below.
+*/
+template <typename Element> bool parseMatrixRow(const Element &e, glm::mat4 &m, int col) {
+   float *valuePtr = glm::value_ptr(m);
+   float a, b, c, d;
+   if (!parseQuadruple(e, a, b, c, d, "a", "b", "c", "d")
+           && !parseQuadruple(e, a, b, c, d, "v1", "v2", "v3", "v4")) {
+       PARSE_ERROR(e);
+       return false;
+   }
+   valuePtr[0*4 + col] = a;
+   valuePtr[1*4 + col] = b;
+   valuePtr[2*4 + col] = c;
+   valuePtr[3*4 + col] = d;
+   return true;
+}
+
 /**
 * Helper function to parse a matrix. Assumes the input matrix is row-major, which is converted to
 * a column-major glm matrix.
@@ -231,23 +215,14 @@ template <typename T> bool parseQuadruple(
 * </matrix>
 */
 bool parseMatrix(const QDomElement &matrix, glm::mat4 &m) {
-   float *valuePtr = glm::value_ptr(m);
    QDomNode childNode = matrix.firstChild();
    int col = 0;
 
    while (!childNode.isNull()) {
        QDomElement e = childNode.toElement();
        if (e.isElement()) {
-           float a, b, c, d;
-           if (!parseQuadruple(e, a, b, c, d, "a", "b", "c", "d")
-                   && !parseQuadruple(e, a, b, c, d, "v1", "v2", "v3", "v4")) {
-               PARSE_ERROR(e);
+           if (!parseMatrixRow(e, m, col))
                return false;
-           }
-           valuePtr[0*4 + col] = a;
-           valuePtr[1*4 + col] = b;
-           valuePtr[2*4 + col] = c;
-           valuePtr[3*4 + col] = d;
            if (++col == 4) break;
        }
        childNode = childNode.nextSibling();
@@ -256,11 +231,23 @@ bool parseMatrix(const QDomElement &matrix, glm::mat4 &m) {
    return (col == 4);
 }
 
+/**
+* Streaming version of parseMatrix, reading to the end of the <matrix>.
+*/
+bool parseMatrix(QXmlStreamReader &xml, glm::mat4 &m) {
+   int col = 0;
+   bool success = forEachChild(xml, [&](const StreamElement &e) {
+       // Rows after the fourth are ignored
+       return col == 4 || parseMatrixRow(e, m, col++);
+   });
+   return success && (col == 4);
+}
+
 /**
 * Helper function to parse a color.  Will parse an element with r, g, b, and
 * a attributes (the a attribute is optional and defaults to 1).
 */
-bool parseColor(const QDomElement &color, SceneColor &c) {
+template <typename Element> bool parseColor(const Element &color, SceneColor &c) {
    c.a = 1;
    return parseQuadruple(color, c.r, c.g, c.b, c.a, "r", "g", "b", "a") ||
           parseQuadruple(color, c.r, c.g, c.b, c.a, "x", "y", "z", "w") ||
@@ -272,8 +259,10 @@ bool parseColor(const QDomElement &color, SceneColor &c) {
 * Helper function to parse a texture map tag. The texture map image should be relative to the root directory of
 * scenefile root. Example texture map tag:
 * <texture file="/image/andyVanDam.jpg" u="1" v="1"/>
+*
+* An optional compress="true" attribute keeps the texture block-compressed in memory.
 */
-bool parseMap(const QDomElement &e, SceneFileMap &map, const std::filesystem::path &basepath) {
+template <typename Element> bool parseMap(const Element &e, SceneFileMap &map, const std::filesystem::path &basepath) {
    if (!e.hasAttribute("file"))
        return false;
 
@@ -282,251 +271,624 @@ bool parseMap(const QDomElement &e, SceneFileMap &map, const std::filesystem::pa
    map.filename = (basepath / fileRelativePath).string();
    map.repeatU = e.hasAttribute("u") ? e.attribute("u").toFloat() : 1;
    map.repeatV = e.hasAttribute("v") ? e.attribute("v").toFloat() : 1;
+   map.compress = e.attribute("compress") == "true";
    map.isUsed = true;
    return true;
 }
 
 /**
-* Parse a <globaldata> tag and fill in m_globalData.
+* Parse one child of a <globaldata> tag into globalData. Unknown children are ignored.
 */
-bool ScenefileReader::parseGlobalData(const QDomElement &globaldata) {
-   // Iterate over child elements
-   QDomNode childNode = globaldata.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
-       if (e.tagName() == "ambientcoeff") {
-           if (!parseSingle(e, m_globalData.ka, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "diffusecoeff") {
-           if (!parseSingle(e, m_globalData.kd, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "specularcoeff") {
-           if (!parseSingle(e, m_globalData.ks, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "transparentcoeff") {
-           if (!parseSingle(e, m_globalData.kt, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
+template <typename Element> bool parseGlobalElement(const Element &e, SceneGlobalData &globalData) {
+   if (e.tagName() == "ambientcoeff") {
+       if (!parseSingle(e, globalData.ka, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "diffusecoeff") {
+       if (!parseSingle(e, globalData.kd, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "specularcoeff") {
+       if (!parseSingle(e, globalData.ks, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "transparentcoeff") {
+       if (!parseSingle(e, globalData.kt, "v")) {
+           PARSE_ERROR(e);
+           return false;
        }
-       childNode = childNode.nextSibling();
    }
-
    return true;
 }
 
 /**
-* Parse a <lightdata> tag and add a new CS123SceneLightData to m_lights.
+* Create a default light for a <lightdata> tag in arena.
 */
-bool ScenefileReader::parseLightData(const QDomElement &lightdata) {
-   // Create a default light
-   SceneLightData* light = new SceneLightData();
-   m_lights.push_back(light);
+SceneLightData* newLight(Arena &arena) {
+   SceneLightData* light = arena.make<SceneLightData>();
    memset(light, 0, sizeof(SceneLightData));
    light->pos = glm::vec4(3.f, 3.f, 3.f, 1.f);
    light->dir = glm::vec4(0.f, 0.f, 0.f, 0.f);
    light->color.r = light->color.g = light->color.b = 1;
    light->function = glm::vec3(1, 0, 0);
+   return light;
+}
 
-   // Iterate over child elements
-   QDomNode childNode = lightdata.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
-       if (e.tagName() == "id") {
-           if (!parseInt(e, light->id, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "type") {
-           if (!e.hasAttribute("v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-           if (e.attribute("v") == "directional") light->type = LightType::LIGHT_DIRECTIONAL;
-           else if (e.attribute("v") == "point") light->type = LightType::LIGHT_POINT;
-           else if (e.attribute("v") == "spot") light->type = LightType::LIGHT_SPOT;
-           else if (e.attribute("v") == "area") light->type = LightType::LIGHT_AREA;
-           else {
-               std::cout << ERROR_AT(e) << "unknown light type " << e.attribute("v").toStdString() << std::endl;
-               return false;
-           }
-       } else if (e.tagName() == "color") {
-           if (!parseColor(e, light->color)) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "function") {
-           if (!parseTriple(e, light->function.x, light->function.y, light->function.z, "a", "b", "c") &&
-               !parseTriple(e, light->function.x, light->function.y, light->function.z, "x", "y", "z") &&
-               !parseTriple(e, light->function.x, light->function.y, light->function.z, "v1", "v2", "v3")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "position") {
-           if (light->type == LightType::LIGHT_DIRECTIONAL) {
-               std::cout << ERROR_AT(e) << "position is not applicable to directional lights" << std::endl;
-               return false;
-           }
-           if (!parseTriple(e, light->pos.x, light->pos.y, light->pos.z, "x", "y", "z")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "direction") {
-           if (light->type == LightType::LIGHT_POINT) {
-               std::cout << ERROR_AT(e) << "direction is not applicable to point lights" << std::endl;
-               return false;
-           }
-           if (!parseTriple(e, light->dir.x, light->dir.y, light->dir.z, "x", "y", "z")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "penumbra") {
-           if (light->type != LightType::LIGHT_SPOT) {
-               std::cout << ERROR_AT(e) << "penumbra is only applicable to spot lights" << std::endl;
-               return false;
-           }
-           float penumbra = 0.f;
-           if (!parseSingle(e, penumbra, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
+/**
+* Parse one child of a <lightdata> tag into light.
+*/
+template <typename Element> bool parseLightElement(const Element &e, SceneLightData* light) {
+   if (e.tagName() == "id") {
+       if (!parseInt(e, light->id, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "type") {
+       if (!e.hasAttribute("v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+       if (e.attribute("v") == "directional") light->type = LightType::LIGHT_DIRECTIONAL;
+       else if (e.attribute("v") == "point") light->type = LightType::LIGHT_POINT;
+       else if (e.attribute("v") == "spot") light->type = LightType::LIGHT_SPOT;
+       else if (e.attribute("v") == "area") light->type = LightType::LIGHT_AREA;
+       else {
+           std::cout << ERROR_AT(e) << "unknown light type " << e.attribute("v").toStdString() << std::endl;
+           return false;
+       }
+   } else if (e.tagName() == "color") {
+       if (!parseColor(e, light->color)) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "function") {
+       if (!parseTriple(e, light->function.x, light->function.y, light->function.z, "a", "b", "c") &&
+           !parseTriple(e, light->function.x, light->function.y, light->function.z, "x", "y", "z") &&
+           !parseTriple(e, light->function.x, light->function.y, light->function.z, "v1", "v2", "v3")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "position") {
+       if (light->type == LightType::LIGHT_DIRECTIONAL) {
+           std::cout << ERROR_AT(e) << "position is not applicable to directional lights" << std::endl;
+           return false;
+       }
+       if (!parseTriple(e, light->pos.x, light->pos.y, light->pos.z, "x", "y", "z")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "direction") {
+       if (light->type == LightType::LIGHT_POINT) {
+           std::cout << ERROR_AT(e) << "direction is not applicable to point lights" << std::endl;
+           return false;
+       }
+       if (!parseTriple(e, light->dir.x, light->dir.y, light->dir.z, "x", "y", "z")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "penumbra") {
+       if (light->type != LightType::LIGHT_SPOT) {
+           std::cout << ERROR_AT(e) << "penumbra is only applicable to spot lights" << std::endl;
+           return false;
+       }
+       float penumbra = 0.f;
+       if (!parseSingle(e, penumbra, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
 
-           light->penumbra = penumbra * M_PI / 180.f;
-       } else if (e.tagName() == "angle") {
-           if (light->type != LightType::LIGHT_SPOT) {
-               std::cout << ERROR_AT(e) << "angle is only applicable to spot lights" << std::endl;
-               return false;
-           }
+       light->penumbra = penumbra * M_PI / 180.f;
+   } else if (e.tagName() == "angle") {
+       if (light->type != LightType::LIGHT_SPOT) {
+           std::cout << ERROR_AT(e) << "angle is only applicable to spot lights" << std::endl;
+           return false;
+       }
 
-           float angle = 0.f;
-           if (!parseSingle(e, angle, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-           light->angle = angle * M_PI / 180.f;
-       } else if (e.tagName() == "width") {
-           if (light->type != LightType::LIGHT_AREA) {
-               std::cout << ERROR_AT(e) << "width is only applicable to area lights" << std::endl;
-               return false;
-           }
-           if (!parseSingle(e, light->width, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "height") {
-           if (light->type != LightType::LIGHT_AREA) {
-               std::cout << ERROR_AT(e) << "height is only applicable to area lights" << std::endl;
-               return false;
-           }
-           if (!parseSingle(e, light->height, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (!e.isNull()) {
-           UNSUPPORTED_ELEMENT(e);
+       float angle = 0.f;
+       if (!parseSingle(e, angle, "v")) {
+           PARSE_ERROR(e);
            return false;
        }
-       childNode = childNode.nextSibling();
+       light->angle = angle * M_PI / 180.f;
+   } else if (e.tagName() == "width") {
+       if (light->type != LightType::LIGHT_AREA) {
+           std::cout << ERROR_AT(e) << "width is only applicable to area lights" << std::endl;
+           return false;
+       }
+       if (!parseSingle(e, light->width, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "height") {
+       if (light->type != LightType::LIGHT_AREA) {
+           std::cout << ERROR_AT(e) << "height is only applicable to area lights" << std::endl;
+           return false;
+       }
+       if (!parseSingle(e, light->height, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (!e.isNull()) {
+       UNSUPPORTED_ELEMENT(e);
+       return false;
    }
-
    return true;
 }
 
 /**
-* Parse a <cameradata> tag and fill in m_cameraData.
+* Which of the camera's optional tags a <cameradata> tag has set so far.
 */
-bool ScenefileReader::parseCameraData(const QDomElement &cameradata) {
+struct CameraTags {
    bool focusFound = false;
    bool lookFound = false;
+   bool focalLengthFound = false;
+};
 
-   // Iterate over child elements
-   QDomNode childNode = cameradata.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
-       if (e.tagName() == "pos") {
-           if (!parseTriple(e, m_cameraData.pos.x, m_cameraData.pos.y, m_cameraData.pos.z, "x", "y", "z")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-           m_cameraData.pos.w = 1;
-       } else if (e.tagName() == "look" || e.tagName() == "focus") {
-           if (!parseTriple(e, m_cameraData.look.x, m_cameraData.look.y, m_cameraData.look.z, "x", "y", "z")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-
-           if (e.tagName() == "focus") {
-               // Store the focus point in the look vector (we will later subtract
-               // the camera position from this to get the actual look vector)
-               m_cameraData.look.w = 1;
-               focusFound = true;
-           } else {
-               // Just store the look vector
-               m_cameraData.look.w = 0;
-               lookFound = true;
-           }
-       } else if (e.tagName() == "up") {
-           if (!parseTriple(e, m_cameraData.up.x, m_cameraData.up.y, m_cameraData.up.z, "x", "y", "z")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-           m_cameraData.up.w = 0;
-       } else if (e.tagName() == "heightangle") {
-           float heightAngle = 0.f;
-           if (!parseSingle(e, heightAngle, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-           m_cameraData.heightAngle = heightAngle * M_PI / 180.f;
-       } else if (e.tagName() == "aperture") {
-           if (!parseSingle(e, m_cameraData.aperture, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "focallength") {
-           if (!parseSingle(e, m_cameraData.focalLength, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (!e.isNull()) {
-           UNSUPPORTED_ELEMENT(e);
+/**
+* Parse one child of a <cameradata> tag into cameraData.
+*/
+template <typename Element> bool parseCameraElement(const Element &e, SceneCameraData &cameraData, CameraTags &tags) {
+   if (e.tagName() == "pos") {
+       if (!parseTriple(e, cameraData.pos.x, cameraData.pos.y, cameraData.pos.z, "x", "y", "z")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+       cameraData.pos.w = 1;
+   } else if (e.tagName() == "look" || e.tagName() == "focus") {
+       if (!parseTriple(e, cameraData.look.x, cameraData.look.y, cameraData.look.z, "x", "y", "z")) {
+           PARSE_ERROR(e);
            return false;
        }
-       childNode = childNode.nextSibling();
-   }
-
-   if (focusFound && lookFound) {
-       std::cout << ERROR_AT(cameradata) << "camera can not have both look and focus" << std::endl;
-       return false;
-   }
 
-   if (focusFound) {
+       if (e.tagName() == "focus") {
+           // Store the focus point in the look vector (we will later subtract
+           // the camera position from this to get the actual look vector)
+           cameraData.look.w = 1;
+           tags.focusFound = true;
+       } else {
+           // Just store the look vector
+           cameraData.look.w = 0;
+           tags.lookFound = true;
+       }
+   } else if (e.tagName() == "up") {
+       if (!parseTriple(e, cameraData.up.x, cameraData.up.y, cameraData.up.z, "x", "y", "z")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+       cameraData.up.w = 0;
+   } else if (e.tagName() == "heightangle") {
+       float heightAngle = 0.f;
+       if (!parseSingle(e, heightAngle, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+       cameraData.heightAngle = heightAngle * M_PI / 180.f;
+   } else if (e.tagName() == "aperture") {
+       if (!parseSingle(e, cameraData.aperture, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "focallength") {
+       if (!parseSingle(e, cameraData.focalLength, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+       tags.focalLengthFound = true;
+   } else if (!e.isNull()) {
+       UNSUPPORTED_ELEMENT(e);
+       return false;
+   }
+   return true;
+}
+
+/**
+* Check and finish the camera once all of the <cameradata> tag is read.
+*/
+template <typename Element> bool finishCamera(const Element &cameradata, SceneCameraData &cameraData, const CameraTags &tags) {
+   if (tags.focusFound && tags.lookFound) {
+       std::cout << ERROR_AT(cameradata) << "camera can not have both look and focus" << std::endl;
+       return false;
+   }
+
+   if (tags.focusFound) {
        // Convert the focus point (stored in the look vector) into a
        // look vector from the camera position to that focus point.
-       m_cameraData.look -= m_cameraData.pos;
+       cameraData.look -= cameraData.pos;
+
+       // Unless told otherwise, keep the focus point in focus
+       if (!tags.focalLengthFound) {
+           cameraData.focalLength = glm::length(glm::vec3(cameraData.look));
+       }
+   }
+
+   if (cameraData.aperture < 0.f || cameraData.focalLength <= 0.f) {
+       std::cout << ERROR_AT(cameradata) << "camera needs a non-negative aperture and a positive focal length" << std::endl;
+       return false;
    }
 
    return true;
 }
 
 /**
-* Parse an <object> tag and create a new CS123SceneNode in m_nodes.
+* Add keyframe to keyframes, which are in time order, replacing any keyframe at the same time.
 */
-bool ScenefileReader::parseObjectData(const QDomElement &object) {
+template <typename Keyframes, typename Keyframe> void insertKeyframe(Keyframes &keyframes, const Keyframe &keyframe) {
+   auto at = std::lower_bound(keyframes.begin(), keyframes.end(), keyframe.time,
+                              [](const Keyframe &k, float time) { return k.time < time; });
+   if (at != keyframes.end() && at->time == keyframe.time)
+       *at = keyframe;
+   else
+       keyframes.insert(at, keyframe);
+}
+
+/**
+* Parse a <keyframe> child of a <cameradata> tag into keyframes. It holds the camera's tags at
+* time t, in seconds, and starts from the camera as the tags before it have set it, so it only
+* needs the tags that change. readChildren calls its argument on each child element of keyframe.
+* For example, to dolly in and turn over ten seconds:
+*
+* <keyframe t="10">
+*   <pos x="0" y="0" z="2"/>
+*   <focus x="1" y="0" z="0"/>
+* </keyframe>
+*/
+template <typename Element, typename ReadChildren>
+bool parseCameraKeyframe(const Element &keyframe, const SceneCameraData &cameraData, const CameraTags &tags,
+                         ReadChildren &&readChildren, std::vector<SceneCameraKeyframe> &keyframes) {
+   SceneCameraKeyframe key{0.f, cameraData};
+   if (!parseSingle(keyframe, key.time, "t")) {
+       PARSE_ERROR(keyframe);
+       return false;
+   }
+
+   CameraTags keyTags;
+   if (!readChildren([&key, &keyTags](const auto &e) { return parseCameraElement(e, key.camera, keyTags); }))
+       return false;
+
+   // Without a look or focus of its own, the keyframe keeps the camera's
+   if (!keyTags.lookFound && !keyTags.focusFound) {
+       keyTags.lookFound = tags.lookFound;
+       keyTags.focusFound = tags.focusFound;
+   }
+   keyTags.focalLengthFound = keyTags.focalLengthFound || tags.focalLengthFound;
+   if (!finishCamera(keyframe, key.camera, keyTags))
+       return false;
+
+   insertKeyframe(keyframes, key);
+   return true;
+}
+
+/**
+* Once a <cameradata> tag with keyframes is read, the camera its own tags describe is the
+* keyframe at time 0, unless a keyframe replaces it.
+*/
+void finishCameraKeyframes(const SceneCameraData &cameraData, std::vector<SceneCameraKeyframe> &keyframes) {
+   if (keyframes.empty() || keyframes.front().time == 0.f)
+       return;
+   insertKeyframe(keyframes, SceneCameraKeyframe{0.f, cameraData});
+}
+
+/**
+* Parse a <translate>, <rotate> or <scale> child of a <transblock> tag into a
+* transformation appended to node, made in arena. Returns false, printing nothing, if e is
+* another tag.
+*/
+template <typename Element> bool parseTransformation(const Element &e, SceneNode* node, Arena &arena, bool &success) {
+   success = true;
+   if (e.tagName() == "translate") {
+       SceneTransformation *t = arena.make<SceneTransformation>();
+       node->transformations.push_back(t);
+       t->type = TransformationType::TRANSFORMATION_TRANSLATE;
+
+       if (!parseTriple(e, t->translate.x, t->translate.y, t->translate.z, "x", "y", "z")) {
+           PARSE_ERROR(e);
+           success = false;
+       }
+   } else if (e.tagName() == "rotate") {
+       SceneTransformation *t = arena.make<SceneTransformation>();
+       node->transformations.push_back(t);
+       t->type = TransformationType::TRANSFORMATION_ROTATE;
+
+       float angle;
+       if (!parseQuadruple(e, t->rotate.x, t->rotate.y, t->rotate.z, angle, "x", "y", "z", "angle")) {
+           PARSE_ERROR(e);
+           success = false;
+       }
+
+       // Convert to radians
+       t->angle = angle * M_PI / 180;
+   } else if (e.tagName() == "scale") {
+       SceneTransformation *t = arena.make<SceneTransformation>();
+       node->transformations.push_back(t);
+       t->type = TransformationType::TRANSFORMATION_SCALE;
+
+       if (!parseTriple(e, t->scale.x, t->scale.y, t->scale.z, "x", "y", "z")) {
+           PARSE_ERROR(e);
+           success = false;
+       }
+   } else {
+       return false;
+   }
+   return true;
+}
+
+/**
+* Parse one child of a <translate>, <rotate> or <scale> tag into t, the transformation parsed
+* from that tag. Each <keyframe> child gives the transformation's values at time t, in seconds,
+* leaving out those it keeps from the tag itself, whose values hold at time 0 unless a keyframe
+* replaces them. For example, to turn a full circle about y over ten seconds:
+*
+* <rotate x="0" y="1" z="0" angle="0">
+*   <keyframe t="10" angle="360"/>
+* </rotate>
+*/
+template <typename Element> bool parseTransformationKeyframe(const Element &e, SceneTransformation *t) {
+   if (e.tagName() != "keyframe") {
+       if (e.isNull())
+           return true;
+       UNSUPPORTED_ELEMENT(e);
+       return false;
+   }
+
+   SceneTransformationKeyframe keyframe{0.f, t->translate, t->scale, t->rotate, t->angle};
+   if (!parseSingle(e, keyframe.time, "t")) {
+       PARSE_ERROR(e);
+       return false;
+   }
+   glm::vec3 &values = t->type == TransformationType::TRANSFORMATION_TRANSLATE ? keyframe.translate
+                       : t->type == TransformationType::TRANSFORMATION_SCALE   ? keyframe.scale
+                                                                               : keyframe.rotate;
+   parseSingle(e, values.x, "x");
+   parseSingle(e, values.y, "y");
+   parseSingle(e, values.z, "z");
+   float angle;
+   if (parseSingle(e, angle, "angle"))
+       keyframe.angle = angle * M_PI / 180;
+
+   if (t->keyframes.empty() && keyframe.time != 0.f)
+       t->keyframes.push_back(SceneTransformationKeyframe{0.f, t->translate, t->scale, t->rotate, t->angle});
+   insertKeyframe(t->keyframes, keyframe);
+   return true;
+}
+
+/**
+* Create the primitive for an <object type="primitive"> tag in arena, from its
+* name attribute, and add it to node.
+*/
+template <typename Element> bool beginPrimitive(const Element &prim, SceneNode* node, const std::filesystem::path &basepath,
+                                                Arena &arena, ScenePrimitive* &primitive) {
+   // Default primitive
+   primitive = arena.make<ScenePrimitive>();
+   SceneMaterial& mat = primitive->material;
+   mat.clear();
+   primitive->type = PrimitiveType::PRIMITIVE_CUBE;
+   mat.textureMap.isUsed = false;
+   mat.bumpMap.isUsed = false;
+   mat.cDiffuse.r = mat.cDiffuse.g = mat.cDiffuse.b = 1;
+   node->primitives.push_back(primitive);
+
+   // Parse primitive type
+   std::string primType = prim.attribute("name").toStdString();
+   if (primType == "sphere") primitive->type = PrimitiveType::PRIMITIVE_SPHERE;
+   else if (primType == "cube") primitive->type = PrimitiveType::PRIMITIVE_CUBE;
+   else if (primType == "cylinder") primitive->type = PrimitiveType::PRIMITIVE_CYLINDER;
+   else if (primType == "cone") primitive->type = PrimitiveType::PRIMITIVE_CONE;
+   else if (primType == "torus") primitive->type = PrimitiveType::PRIMITIVE_TORUS;
+   else if (primType == "mesh") {
+       primitive->type = PrimitiveType::PRIMITIVE_MESH;
+       if (prim.hasAttribute("meshfile")) {
+           std::filesystem::path relativePath(prim.attribute("meshfile").toStdString());
+           primitive->meshfile = (basepath / relativePath).string();
+       } else if (prim.hasAttribute("filename")) {
+           std::filesystem::path relativePath(prim.attribute("filename").toStdString());
+           primitive->meshfile = (basepath / relativePath).string();
+       } else {
+           std::cout << "mesh object must specify filename" << std::endl;
+           return false;
+       }
+   }
+   return true;
+}
+
+/**
+* Parse one child of an <object type="primitive"> tag into mat.
+*/
+template <typename Element> bool parseMaterialElement(const Element &e, SceneMaterial &mat, const std::filesystem::path &basepath) {
+   if (e.tagName() == "diffuse") {
+       if (!parseColor(e, mat.cDiffuse)) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "ambient") {
+       if (!parseColor(e, mat.cAmbient)) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "reflective") {
+       if (!parseColor(e, mat.cReflective)) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "specular") {
+       if (!parseColor(e, mat.cSpecular)) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "emissive") {
+       if (!parseColor(e, mat.cEmissive)) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "transparent") {
+       if (!parseColor(e, mat.cTransparent)) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "shininess") {
+       if (!parseSingle(e, mat.shininess, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "ior") {
+       if (!parseSingle(e, mat.ior, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "texture") {
+       if (!parseMap(e, mat.textureMap, basepath)) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "bumpmap") {
+       if (!parseMap(e, mat.bumpMap, basepath)) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else if (e.tagName() == "blend") {
+       if (!parseSingle(e, mat.blend, "v")) {
+           PARSE_ERROR(e);
+           return false;
+       }
+   } else {
+       UNSUPPORTED_ELEMENT(e);
+       return false;
+   }
+   return true;
+}
+
+qint64 ScenefileReader::s_streamingThreshold = 64ll << 20;
+
+void ScenefileReader::setStreamingThreshold(qint64 bytes) {
+   s_streamingThreshold = bytes;
+}
+
+// This is where it all goes down...
+bool ScenefileReader::readXML() {
+   // Read the file
+   QFile file(file_name.c_str());
+   if (!file.open(QFile::ReadOnly)) {
+       std::cout << "could not open " << file_name << std::endl;
+       return false;
+   }
+
+   // Default camera
+   m_cameraData.pos = glm::vec4(5.f, 5.f, 5.f, 1.f);
+   m_cameraData.up = glm::vec4(0.f, 1.f, 0.f, 0.f);
+   m_cameraData.look = glm::vec4(-1.f, -1.f, -1.f, 0.f);
+   m_cameraData.heightAngle = 45 * M_PI / 180.f;
+   m_cameraData.aperture = 0.f;
+   m_cameraData.focalLength = 1.f;
+
+   // Default global data
+   m_globalData.ka = 0.5f;
+   m_globalData.kd = 0.5f;
+   m_globalData.ks = 0.5f;
+
+   // Large files are streamed, so that no document tree is held besides the
+   // scene graph
+   bool streaming = s_streamingThreshold >= 0 && file.size() >= s_streamingThreshold;
+   if (!(streaming ? readStream(file) : readDocument(file))) {
+       return false;
+   }
+
+   std::cout << "Finished reading " << file_name << std::endl;
+   return true;
+}
+
+bool ScenefileReader::readDocument(QFile &file) {
+   // Load the XML document
+   QDomDocument doc;
+   QString errorMessage;
+   int errorLine, errorColumn;
+   if (!doc.setContent(&file, &errorMessage, &errorLine, &errorColumn)) {
+       std::cout << "parse error at line " << errorLine << " col " << errorColumn << ": "
+            << errorMessage.toStdString() << std::endl;
+       return false;
+   }
+   file.close();
+
+   // Get the root element
+   QDomElement scenefile = doc.documentElement();
+   if (scenefile.tagName() != "scenefile") {
+       std::cout << "missing <scenefile>" << std::endl;
+       return false;
+   }
+
+   // Iterate over child elements
+   QDomNode childNode = scenefile.firstChild();
+   while (!childNode.isNull()) {
+       QDomElement e = childNode.toElement();
+       if (e.tagName() == "globaldata") {
+           if (!parseGlobalData(e))
+               return false;
+       } else if (e.tagName() == "lightdata") {
+           if (!parseLightData(e))
+               return false;
+       } else if (e.tagName() == "cameradata") {
+           if (!parseCameraData(e))
+               return false;
+       } else if (e.tagName() == "object") {
+           if (!parseObjectData(e))
+               return false;
+       } else if (!e.isNull()) {
+           UNSUPPORTED_ELEMENT(e);
+           return false;
+       }
+       childNode = childNode.nextSibling();
+   }
+
+   return true;
+}
+
+bool ScenefileReader::readStream(QFile &file) {
+   QXmlStreamReader xml(&file);
+   if (!xml.readNextStartElement() || xml.name() != QLatin1String("scenefile")) {
+       if (xml.hasError()) {
+           std::cout << "parse error at line " << xml.lineNumber() << " col " << xml.columnNumber() << ": "
+                << xml.errorString().toStdString() << std::endl;
+       } else {
+           std::cout << "missing <scenefile>" << std::endl;
+       }
+       return false;
+   }
+
+   bool success = forEachChild(xml, [this, &xml](const StreamElement &e) {
+       if (e.tagName() == "globaldata") {
+           return streamGlobalData(xml);
+       } else if (e.tagName() == "lightdata") {
+           return streamLightData(xml);
+       } else if (e.tagName() == "cameradata") {
+           return streamCameraData(xml);
+       } else if (e.tagName() == "object") {
+           return streamObjectData(xml);
+       }
+       UNSUPPORTED_ELEMENT(e);
+       return false;
+   });
+   // Malformed XML is only found on reaching it, possibly after other errors
+   if (xml.hasError()) {
+       std::cout << "parse error at line " << xml.lineNumber() << " col " << xml.columnNumber() << ": "
+            << xml.errorString().toStdString() << std::endl;
+       return false;
+   }
+   return success;
+}
+
+/**
+* Create the scene node for a top-level <object> tag and register it by name.
+*/
+template <typename Element> SceneNode* ScenefileReader::beginObject(const Element &object) {
    if (!object.hasAttribute("name")) {
        PARSE_ERROR(object);
-       return false;
+       return nullptr;
    }
 
    if (object.attribute("type") != "tree") {
        std::cout << "top-level <object> elements must be of type tree" << std::endl;
-       return false;
+       return nullptr;
    }
 
    std::string name = object.attribute("name").toStdString();
@@ -534,21 +896,115 @@ bool ScenefileReader::parseObjectData(const QDomElement &object) {
    // Check that this object does not exist
    if (m_objects[name]) {
        std::cout << ERROR_AT(object) << "two objects with the same name: " << name << std::endl;
-       return false;
+       return nullptr;
    }
 
    // Create the object and add to the map
-   SceneNode *node = new SceneNode;
-   m_nodes.push_back(node);
+   SceneNode *node = m_arena.make<SceneNode>();
    m_objects[name] = node;
+   return node;
+}
+
+/**
+* Look up the object an <object type="master"> tag refers to.
+*/
+template <typename Element> SceneNode* ScenefileReader::findMaster(const Element &e) {
+   std::string masterName = e.attribute("name").toStdString();
+   if (!m_objects[masterName]) {
+       std::cout << ERROR_AT(e) << "invalid master object reference: " << masterName << std::endl;
+       return nullptr;
+   }
+   return m_objects[masterName];
+}
+
+template <typename Keyframes> void ScenefileReader::addKeyframes(const Keyframes &keyframes) {
+   if (keyframes.empty())
+       return;
+   m_animated = true;
+   m_duration = std::max(m_duration, keyframes.back().time);
+}
+
+/**
+* Parse a <globaldata> tag and fill in m_globalData.
+*/
+bool ScenefileReader::parseGlobalData(const QDomElement &globaldata) {
+   // Iterate over child elements
+   QDomNode childNode = globaldata.firstChild();
+   while (!childNode.isNull()) {
+       if (!parseGlobalElement(childNode.toElement(), m_globalData))
+           return false;
+       childNode = childNode.nextSibling();
+   }
+
+   return true;
+}
+
+/**
+* Parse a <lightdata> tag and add a new CS123SceneLightData to m_lights.
+*/
+bool ScenefileReader::parseLightData(const QDomElement &lightdata) {
+   // Create a default light
+   SceneLightData* light = newLight(m_arena);
+   m_lights.push_back(light);
+
+   // Iterate over child elements
+   QDomNode childNode = lightdata.firstChild();
+   while (!childNode.isNull()) {
+       if (!parseLightElement(childNode.toElement(), light))
+           return false;
+       childNode = childNode.nextSibling();
+   }
+
+   return true;
+}
+
+/**
+* Parse a <cameradata> tag and fill in m_cameraData.
+*/
+bool ScenefileReader::parseCameraData(const QDomElement &cameradata) {
+   CameraTags tags;
+
+   // Iterate over child elements
+   QDomNode childNode = cameradata.firstChild();
+   while (!childNode.isNull()) {
+       QDomElement e = childNode.toElement();
+       if (e.tagName() == "keyframe") {
+           auto readChildren = [&e](auto &&parseChild) {
+               for (QDomNode n = e.firstChild(); !n.isNull(); n = n.nextSibling()) {
+                   if (!parseChild(n.toElement()))
+                       return false;
+               }
+               return true;
+           };
+           if (!parseCameraKeyframe(e, m_cameraData, tags, readChildren, m_cameraKeyframes))
+               return false;
+       } else if (!parseCameraElement(e, m_cameraData, tags)) {
+           return false;
+       }
+       childNode = childNode.nextSibling();
+   }
+
+   if (!finishCamera(cameradata, m_cameraData, tags))
+       return false;
+   finishCameraKeyframes(m_cameraData, m_cameraKeyframes);
+   addKeyframes(m_cameraKeyframes);
+   return true;
+}
+
+/**
+* Parse an <object> tag and create a new CS123SceneNode in m_arena.
+*/
+bool ScenefileReader::parseObjectData(const QDomElement &object) {
+   SceneNode *node = beginObject(object);
+   if (!node)
+       return false;
 
    // Iterate over child elements
    QDomNode childNode = object.firstChild();
    while (!childNode.isNull()) {
        QDomElement e = childNode.toElement();
        if (e.tagName() == "transblock") {
-           SceneNode *child = new SceneNode;
-           m_nodes.push_back(child);
+           SceneNode *child = m_arena.make<SceneNode>();
            if (!parseTransBlock(e, child)) {
                PARSE_ERROR(e);
                return false;
@@ -583,39 +1039,22 @@ bool ScenefileReader::parseTransBlock(const QDomElement &transblock, SceneNode*
    QDomNode childNode = transblock.firstChild();
    while (!childNode.isNull()) {
        QDomElement e = childNode.toElement();
-       if (e.tagName() == "translate") {
-           SceneTransformation *t = new SceneTransformation();
-           node->transformations.push_back(t);
-           t->type = TransformationType::TRANSFORMATION_TRANSLATE;
-
-           if (!parseTriple(e, t->translate.x, t->translate.y, t->translate.z, "x", "y", "z")) {
-               PARSE_ERROR(e);
+       bool success;
+       if (parseTransformation(e, node, m_arena, success)) {
+           if (!success)
                return false;
-           }
-       } else if (e.tagName() == "rotate") {
-           SceneTransformation *t = new SceneTransformation();
-           node->transformations.push_back(t);
-           t->type = TransformationType::TRANSFORMATION_ROTATE;
-
-           float angle;
-           if (!parseQuadruple(e, t->rotate.x, t->rotate.y, t->rotate.z, angle, "x", "y", "z", "angle")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-
-           // Convert to radians
-           t->angle = angle * M_PI / 180;
-       } else if (e.tagName() == "scale") {
-           SceneTransformation *t = new SceneTransformation();
-           node->transformations.push_back(t);
-           t->type = TransformationType::TRANSFORMATION_SCALE;
 
-           if (!parseTriple(e, t->scale.x, t->scale.y, t->scale.z, "x", "y", "z")) {
-               PARSE_ERROR(e);
-               return false;
+           // Animated transformations hold their keyframes
+           SceneTransformation* t = node->transformations.back();
+           QDomNode keyNode = e.firstChild();
+           while (!keyNode.isNull()) {
+               if (!parseTransformationKeyframe(keyNode.toElement(), t))
+                   return false;
+               keyNode = keyNode.nextSibling();
            }
+           addKeyframes(t->keyframes);
        } else if (e.tagName() == "matrix") {
-           SceneTransformation* t = new SceneTransformation();
+           SceneTransformation* t = m_arena.make<SceneTransformation>();
            node->transformations.push_back(t);
            t->type = TransformationType::TRANSFORMATION_MATRIX;
 
@@ -625,19 +1064,16 @@ bool ScenefileReader::parseTransBlock(const QDomElement &transblock, SceneNode*
            }
        } else if (e.tagName() == "object") {
            if (e.attribute("type") == "master") {
-               std::string masterName = e.attribute("name").toStdString();
-               if (!m_objects[masterName]) {
-                   std::cout << ERROR_AT(e) << "invalid master object reference: " << masterName << std::endl;
+               SceneNode* master = findMaster(e);
+               if (!master)
                    return false;
-               }
-               node->children.push_back(m_objects[masterName]);
+               node->children.push_back(master);
            } else if (e.attribute("type") == "tree") {
                QDomNode subNode = e.firstChild();
                while (!subNode.isNull()) {
                    QDomElement e = subNode.toElement();
                    if (e.tagName() == "transblock") {
-                       SceneNode* n = new SceneNode;
-                       m_nodes.push_back(n);
+                       SceneNode* n = m_arena.make<SceneNode>();
                        node->children.push_back(n);
                        if (!parseTransBlock(e, n)) {
                            PARSE_ERROR(e);
@@ -672,104 +1108,145 @@ bool ScenefileReader::parseTransBlock(const QDomElement &transblock, SceneNode*
 * Parse an <object type="primitive"> tag into node.
 */
 bool ScenefileReader::parsePrimitive(const QDomElement &prim, SceneNode* node) {
-   // Default primitive
-   ScenePrimitive* primitive = new ScenePrimitive();
-   SceneMaterial& mat = primitive->material;
-   mat.clear();
-   primitive->type = PrimitiveType::PRIMITIVE_CUBE;
-   mat.textureMap.isUsed = false;
-   mat.bumpMap.isUsed = false;
-   mat.cDiffuse.r = mat.cDiffuse.g = mat.cDiffuse.b = 1;
-   node->primitives.push_back(primitive);
-
    std::filesystem::path basepath = std::filesystem::path(file_name).parent_path().parent_path();
-
-   // Parse primitive type
-   std::string primType = prim.attribute("name").toStdString();
-   if (primType == "sphere") primitive->type = PrimitiveType::PRIMITIVE_SPHERE;
-   else if (primType == "cube") primitive->type = PrimitiveType::PRIMITIVE_CUBE;
-   else if (primType == "cylinder") primitive->type = PrimitiveType::PRIMITIVE_CYLINDER;
-   else if (primType == "cone") primitive->type = PrimitiveType::PRIMITIVE_CONE;
-   else if (primType == "torus") primitive->type = PrimitiveType::PRIMITIVE_TORUS;
-   else if (primType == "mesh") {
-       primitive->type = PrimitiveType::PRIMITIVE_MESH;
-       if (prim.hasAttribute("meshfile")) {
-           std::filesystem::path relativePath(prim.attribute("meshfile").toStdString());
-           primitive->meshfile = (basepath / relativePath).string();
-       } else if (prim.hasAttribute("filename")) {
-           std::filesystem::path relativePath(prim.attribute("filename").toStdString());
-           primitive->meshfile = (basepath / relativePath).string();
-       } else {
-           std::cout << "mesh object must specify filename" << std::endl;
-           return false;
-       }
-   }
+   ScenePrimitive* primitive;
+   if (!beginPrimitive(prim, node, basepath, m_arena, primitive))
+       return false;
 
    // Iterate over child elements
    QDomNode childNode = prim.firstChild();
    while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
-       if (e.tagName() == "diffuse") {
-           if (!parseColor(e, mat.cDiffuse)) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "ambient") {
-           if (!parseColor(e, mat.cAmbient)) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "reflective") {
-           if (!parseColor(e, mat.cReflective)) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "specular") {
-           if (!parseColor(e, mat.cSpecular)) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "emissive") {
-           if (!parseColor(e, mat.cEmissive)) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "transparent") {
-           if (!parseColor(e, mat.cTransparent)) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "shininess") {
-           if (!parseSingle(e, mat.shininess, "v")) {
-               PARSE_ERROR(e);
-               return false;
-           }
-       } else if (e.tagName() == "ior") {
-           if (!parseSingle(e, mat.ior, "v")) {
+       if (!parseMaterialElement(childNode.toElement(), primitive->material, basepath))
+           return false;
+       childNode = childNode.nextSibling();
+   }
+
+   return true;
+}
+
+/*
+* The streaming counterparts of the functions above each start with xml on
+* their tag's start and read it to its end.
+*/
+
+bool ScenefileReader::streamGlobalData(QXmlStreamReader &xml) {
+   return forEachChild(xml, [this](const StreamElement &e) {
+       return parseGlobalElement(e, m_globalData);
+   });
+}
+
+bool ScenefileReader::streamLightData(QXmlStreamReader &xml) {
+   SceneLightData* light = newLight(m_arena);
+   m_lights.push_back(light);
+   return forEachChild(xml, [light](const StreamElement &e) {
+       return parseLightElement(e, light);
+   });
+}
+
+bool ScenefileReader::streamCameraData(QXmlStreamReader &xml) {
+   StreamElement cameradata(xml);
+   CameraTags tags;
+   bool success = forEachChild(xml, [this, &xml, &tags](const StreamElement &e) {
+       if (e.tagName() == "keyframe") {
+           auto readChildren = [&xml](auto &&parseChild) { return forEachChild(xml, parseChild); };
+           return parseCameraKeyframe(e, m_cameraData, tags, readChildren, m_cameraKeyframes);
+       }
+       return parseCameraElement(e, m_cameraData, tags);
+   });
+   if (!success || !finishCamera(cameradata, m_cameraData, tags))
+       return false;
+   finishCameraKeyframes(m_cameraData, m_cameraKeyframes);
+   addKeyframes(m_cameraKeyframes);
+   return true;
+}
+
+bool ScenefileReader::streamObjectData(QXmlStreamReader &xml) {
+   SceneNode *node = beginObject(StreamElement(xml));
+   if (!node)
+       return false;
+
+   return forEachChild(xml, [this, &xml, node](const StreamElement &e) {
+       if (e.tagName() == "transblock") {
+           SceneNode *child = m_arena.make<SceneNode>();
+           if (!streamTransBlock(xml, child)) {
                PARSE_ERROR(e);
                return false;
            }
-       } else if (e.tagName() == "texture") {
-           if (!parseMap(e, mat.textureMap, basepath)) {
-               PARSE_ERROR(e);
+           node->children.push_back(child);
+           return true;
+       }
+       UNSUPPORTED_ELEMENT(e);
+       return false;
+   });
+}
+
+bool ScenefileReader::streamTransBlock(QXmlStreamReader &xml, SceneNode* node) {
+   return forEachChild(xml, [this, &xml, node](const StreamElement &e) {
+       bool success;
+       if (parseTransformation(e, node, m_arena, success)) {
+           if (!success)
                return false;
-           }
-       } else if (e.tagName() == "bumpmap") {
-           if (!parseMap(e, mat.bumpMap, basepath)) {
+
+           // Animated transformations hold their keyframes
+           SceneTransformation* t = node->transformations.back();
+           success = forEachChild(xml, [t](const StreamElement &e) {
+               return parseTransformationKeyframe(e, t);
+           });
+           addKeyframes(t->keyframes);
+           return success;
+       } else if (e.tagName() == "matrix") {
+           SceneTransformation* t = m_arena.make<SceneTransformation>();
+           node->transformations.push_back(t);
+           t->type = TransformationType::TRANSFORMATION_MATRIX;
+
+           if (!parseMatrix(xml, t->matrix)) {
                PARSE_ERROR(e);
                return false;
            }
-       } else if (e.tagName() == "blend") {
-           if (!parseSingle(e, mat.blend, "v")) {
-               PARSE_ERROR(e);
-               return false;
+           return true;
+       } else if (e.tagName() == "object") {
+           if (e.attribute("type") == "master") {
+               SceneNode* master = findMaster(e);
+               if (!master)
+                   return false;
+               node->children.push_back(master);
+               return true;
+           } else if (e.attribute("type") == "tree") {
+               return forEachChild(xml, [this, &xml, node](const StreamElement &e) {
+                   if (e.tagName() == "transblock") {
+                       SceneNode* n = m_arena.make<SceneNode>();
+                       node->children.push_back(n);
+                       if (!streamTransBlock(xml, n)) {
+                           PARSE_ERROR(e);
+                           return false;
+                       }
+                       return true;
+                   }
+                   UNSUPPORTED_ELEMENT(e);
+                   return false;
+               });
+           } else if (e.attribute("type") == "primitive") {
+               if (!streamPrimitive(xml, node)) {
+                   PARSE_ERROR(e);
+                   return false;
+               }
+               return true;
            }
-       } else {
-           UNSUPPORTED_ELEMENT(e);
+           std::cout << ERROR_AT(e) << "invalid object type: " << e.attribute("type").toStdString() << std::endl;
            return false;
        }
-       childNode = childNode.nextSibling();
-   }
+       UNSUPPORTED_ELEMENT(e);
+       return false;
+   });
+}
 
-   return true;
+bool ScenefileReader::streamPrimitive(QXmlStreamReader &xml, SceneNode* node) {
+   std::filesystem::path basepath = std::filesystem::path(file_name).parent_path().parent_path();
+   ScenePrimitive* primitive;
+   if (!beginPrimitive(StreamElement(xml), node, basepath, m_arena, primitive))
+       return false;
+
+   return forEachChild(xml, [&](const StreamElement &e) {
+       return parseMaterialElement(e, primitive->material, basepath);
+   });
 }
@@ -1,11 +1,14 @@
 #pragma once
 
+#include "arena.h"
 #include "scenedata.h"
 
 #include <vector>
 #include <map>
 
 #include <QDomDocument>
+#include <QFile>
+#include <QXmlStreamReader>
 
 // This class parses the scene graph specified by the CS123 Xml file format.
 class ScenefileReader {
@@ -13,16 +16,26 @@ public:
     // Create a ScenefileReader, passing it the scene file.
     ScenefileReader(const std::string& filename);
 
-    // Clean up all data for the scene
-    ~ScenefileReader();
-
     // Parse the XML scene file. Returns false if scene is invalid.
+    // Files at least as large as the streaming threshold are read as a stream,
+    // without holding a document tree for the whole file in memory.
     bool readXML();
 
+    // Sets the file size in bytes from which scenes are streamed. 0 streams
+    // every file, and a negative threshold none.
+    static void setStreamingThreshold(qint64 bytes);
+
     SceneGlobalData getGlobalData() const;
 
     SceneCameraData getCameraData() const;
 
+    // The keyframes of an animated camera, in time order; empty if it's still.
+    const std::vector<SceneCameraKeyframe>& getCameraKeyframes() const;
+
+    // Whether the camera or any transformation has keyframes, and the time of the last one.
+    bool isAnimated() const;
+    float getDuration() const;
+
     std::vector<SceneLightData> getLights() const;
 
     SceneNode* getRootNode() const;
@@ -37,10 +50,37 @@ private:
     bool parseTransBlock(const QDomElement &transblock, SceneNode* node);
     bool parsePrimitive(const QDomElement &prim, SceneNode* node);
 
+    // Parsing shared by the document and stream readers
+    template <typename Element> SceneNode* beginObject(const Element &object);
+    template <typename Element> SceneNode* findMaster(const Element &e);
+
+    // Notes that the scene is animated if keyframes isn't empty
+    template <typename Keyframes> void addKeyframes(const Keyframes &keyframes);
+
+    // Read the whole file as a document tree, or as a stream of elements
+    bool readDocument(QFile &file);
+    bool readStream(QFile &file);
+
+    // Streaming versions of the above, each reading its element to the end
+    bool streamGlobalData(QXmlStreamReader &xml);
+    bool streamLightData(QXmlStreamReader &xml);
+    bool streamCameraData(QXmlStreamReader &xml);
+    bool streamObjectData(QXmlStreamReader &xml);
+    bool streamTransBlock(QXmlStreamReader &xml, SceneNode* node);
+    bool streamPrimitive(QXmlStreamReader &xml, SceneNode* node);
+
+    static qint64 s_streamingThreshold;
+
     std::string file_name;
     mutable std::map<std::string, SceneNode*> m_objects;
     SceneGlobalData m_globalData;
     SceneCameraData m_cameraData;
+    std::vector<SceneCameraKeyframe> m_cameraKeyframes;
+    bool m_animated = false;
+    float m_duration = 0.f;
     std::vector<SceneLightData*> m_lights;
-    std::vector<SceneNode*> m_nodes;
+
+    // Holds every node, transformation, primitive and light of the scene,
+    // all freed together with the reader
+    Arena m_arena;
 };
@@ -1,38 +1,86 @@
 #include "sceneparser.h"
 #include "glm/gtx/transform.hpp"
+#include "scenefile.h"
 #include "scenefilereader.h"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <memory>
 
+namespace {
+
+// Finds the keyframes on either side of time, and sets blend to how far time
+// is from the first to the second. Outside the keyframes, both are the
+// nearest one.
+template <typename Keyframe>
+std::pair<const Keyframe *, const Keyframe *>
+surroundingKeyframes(const Keyframe *begin, const Keyframe *end, float time,
+                     float &blend) {
+  const Keyframe *next =
+      std::upper_bound(begin, end, time, [](float time, const Keyframe &k) {
+        return time < k.time;
+      });
+  blend = 0;
+  if (next == begin) {
+    return {begin, begin};
+  }
+  if (next == end) {
+    return {end - 1, end - 1};
+  }
+  const Keyframe *previous = next - 1;
+  blend = (time - previous->time) / (next->time - previous->time);
+  return {previous, next};
+}
+
+// The values of an animated transformation at time
+SceneTransformationKeyframe evaluateKeyframes(const SceneTransformation &t,
+                                              float time) {
+  float blend;
+  auto [a, b] = surroundingKeyframes(
+      t.keyframes.data(), t.keyframes.data() + t.keyframes.size(), time, blend);
+  SceneTransformationKeyframe values = *a;
+  values.translate = glm::mix(a->translate, b->translate, blend);
+  values.scale = glm::mix(a->scale, b->scale, blend);
+  values.angle = glm::mix(a->angle, b->angle, blend);
+  // Opposite axes have no direction halfway between them
+  glm::vec3 axis = glm::mix(a->rotate, b->rotate, blend);
+  if (glm::length(axis) > 1e-6f) {
+    values.rotate = axis;
+  }
+  return values;
+}
+
+} // namespace
+
 bool SceneParser::parse(std::string filepath, RenderData &renderData) {
-  ScenefileReader fileReader = ScenefileReader(filepath);
-  bool success = fileReader.readXML();
-  if (!success) {
+  SceneAnimation scene;
+  if (!scene.load(filepath)) {
     return false;
   }
-  renderData.shapes.clear();
-  auto root = fileReader.getRootNode();
-  parseScene(root, glm::mat4(1.f), renderData.shapes);
-  renderData.globalData = fileReader.getGlobalData();
-  renderData.cameraData = fileReader.getCameraData();
-  renderData.lights = fileReader.getLights();
+  scene.evaluate(0, renderData);
   return true;
 }
 
 void SceneParser::parseScene(SceneNode *node, glm::mat4 ctm,
-                             std::vector<RenderShapeData> &shapes) {
+                             std::vector<RenderShapeData> &shapes, float time) {
   for (auto &transformation : node->transformations) {
+    SceneTransformationKeyframe values{0, transformation->translate,
+                                       transformation->scale,
+                                       transformation->rotate,
+                                       transformation->angle};
+    if (!transformation->keyframes.empty()) {
+      values = evaluateKeyframes(*transformation, time);
+    }
     switch (transformation->type) {
     case TransformationType::TRANSFORMATION_ROTATE:
-      ctm *= glm::rotate(transformation->angle, transformation->rotate);
+      ctm *= glm::rotate(values.angle, values.rotate);
       break;
     case TransformationType::TRANSFORMATION_SCALE:
-      ctm *= glm::scale(transformation->scale);
+      ctm *= glm::scale(values.scale);
       break;
     case TransformationType::TRANSFORMATION_TRANSLATE:
-      ctm *= glm::translate(transformation->translate);
+      ctm *= glm::translate(values.translate);
       break;
     case TransformationType::TRANSFORMATION_MATRIX:
       ctm *= transformation->matrix;
@@ -46,6 +94,69 @@ void SceneParser::parseScene(SceneNode *node, glm::mat4 ctm,
     shapes.push_back(shape);
   }
   for (auto &child : node->children) {
-    parseScene(child, ctm, shapes);
+    parseScene(child, ctm, shapes, time);
+  }
+}
+
+SceneAnimation::SceneAnimation() = default;
+
+SceneAnimation::~SceneAnimation() = default;
+
+bool SceneAnimation::load(const std::string &filepath) {
+  // Compiled scenes are already flattened
+  if (SceneFile::isSceneFile(filepath)) {
+    RenderData still;
+    if (!SceneFile::load(filepath, still)) {
+      return false;
+    }
+    m_still = std::move(still);
+    m_reader.reset();
+    return true;
+  }
+  auto reader = std::make_unique<ScenefileReader>(filepath);
+  if (!reader->readXML()) {
+    return false;
+  }
+  m_reader = std::move(reader);
+  m_still = RenderData();
+  return true;
+}
+
+bool SceneAnimation::isAnimated() const {
+  return m_reader && m_reader->isAnimated();
+}
+
+float SceneAnimation::duration() const {
+  return m_reader ? m_reader->getDuration() : 0;
+}
+
+void SceneAnimation::evaluate(float time, RenderData &renderData) const {
+  if (!m_reader) {
+    renderData = m_still;
+    return;
+  }
+  renderData.shapes.clear();
+  SceneParser::parseScene(m_reader->getRootNode(), glm::mat4(1.f),
+                          renderData.shapes, time);
+  renderData.globalData = m_reader->getGlobalData();
+  renderData.lights = m_reader->getLights();
+
+  const std::vector<SceneCameraKeyframe> &keyframes =
+      m_reader->getCameraKeyframes();
+  if (keyframes.empty()) {
+    renderData.cameraData = m_reader->getCameraData();
+    return;
   }
+  float blend;
+  auto [a, b] = surroundingKeyframes(
+      keyframes.data(), keyframes.data() + keyframes.size(), time, blend);
+  SceneCameraData &camera = renderData.cameraData;
+  camera.pos = glm::mix(a->camera.pos, b->camera.pos, blend);
+  camera.look = glm::mix(a->camera.look, b->camera.look, blend);
+  camera.up = glm::mix(a->camera.up, b->camera.up, blend);
+  camera.heightAngle =
+      glm::mix(a->camera.heightAngle, b->camera.heightAngle, blend);
+  camera.aperture = glm::mix(a->camera.aperture, b->camera.aperture, blend);
+  camera.focalLength =
+      glm::mix(a->camera.focalLength, b->camera.focalLength, blend);
 }
@@ -1,9 +1,12 @@
 #pragma once
 
 #include "scenedata.h"
+#include <memory>
 #include <string>
 #include <vector>
 
+class ScenefileReader;
+
 // Struct which contains data for a single primitive, to be used for rendering
 struct RenderShapeData {
   ScenePrimitive primitive;
@@ -22,12 +25,43 @@ struct RenderData {
 class SceneParser {
 public:
   // Parse the scene and store the results in renderData.
-  // @param filepath    The path of the scene file to load.
+  // @param filepath    The path of the scene file to load, either XML or a
+  // compiled scene.
   // @param renderData  On return, this will contain the metadata of the loaded
   // scene.
   // @return            A boolean value indicating whether the parse was
   // successful.
   static bool parse(std::string filepath, RenderData &renderData);
+
+  // Flattens the scene graph under node into shapes, posed as it is at time,
+  // in seconds, if it's animated.
   static void parseScene(SceneNode *node, glm::mat4 ctm,
-                         std::vector<RenderShapeData> &shapes);
+                         std::vector<RenderShapeData> &shapes, float time = 0);
+};
+
+// A loaded scene that can be flattened as it is at any point in time, so that
+// the frames of an animation don't each read the scene file again. Keyframed
+// values are interpolated linearly, and hold before the first keyframe and
+// after the last.
+class SceneAnimation {
+public:
+  SceneAnimation();
+  ~SceneAnimation();
+
+  // Loads the scene file at filepath, either XML or a compiled scene, which
+  // is always still. Returns false if the scene is invalid, keeping the scene
+  // loaded before.
+  bool load(const std::string &filepath);
+
+  // Whether the camera or any transformation has keyframes, and the time in
+  // seconds of the last one.
+  bool isAnimated() const;
+  float duration() const;
+
+  // Stores the scene as it is at time into renderData.
+  void evaluate(float time, RenderData &renderData) const;
+
+private:
+  std::unique_ptr<ScenefileReader> m_reader;
+  RenderData m_still; // A loaded compiled scene
 };